@@ -49,6 +49,55 @@ typedef struct {
      uint8_t pixel_data[];
 } sodna_Font;
 
+/** Magic bytes at the start of a baked font file */
+#define SODNA_BAKED_FONT_MAGIC "SDNF"
+
+/** Current version of the baked font format */
+#define SODNA_BAKED_FONT_VERSION 1
+
+/**
+ * Pre-baked font structure
+ *
+ * This is the layout of a baked font file, so a file mapped into memory
+ * can be used as is. Unlike sodna_Font, the glyphs are stored one after
+ * another, each as a \a char_width * \a char_height 8-bit grayscale
+ * image. Multi-byte fields are little-endian.
+ */
+typedef struct {
+    /** SODNA_BAKED_FONT_MAGIC, not null-terminated */
+    char magic[4];
+    /** SODNA_BAKED_FONT_VERSION */
+    uint8_t version;
+    /** Width of a single character in pixels */
+    uint8_t char_width;
+    /** Height of a single character in pixels */
+    uint8_t char_height;
+    uint8_t reserved;
+    /** Number of glyphs in the font, at least 256 */
+    uint32_t num_glyphs;
+    /** The glyph pixel data */
+    uint8_t glyph_data[];
+} sodna_BakedFont;
+
+/**
+ * Flags for sodna_set_init_flags()
+ */
+/** Start every backend subsystem, not just the ones Sodna needs */
+#define SODNA_INIT_ALL_SUBSYSTEMS 0x01
+/** Don't show the window, eg. when only using sodna_render_to() */
+#define SODNA_INIT_HIDDEN 0x02
+
+/**
+ * Set the flags used by the following sodna_init() calls.
+ *
+ * By default only the parts of the backend that are needed for the
+ * display and input events are started, since starting the rest, like
+ * audio and joysticks, can slow down the startup noticeably.
+ *
+ * \param flags Bit field of SODNA_INIT_* values.
+ */
+void sodna_set_init_flags(int flags);
+
 /**
  * Start the Sodna terminal.
  *
@@ -63,6 +112,107 @@ sodna_Error sodna_init(
         const char* window_title,
         const sodna_Font* custom_font);
 
+/**
+ * Time spent in the stages of the last sodna_init() call, in microseconds
+ */
+typedef struct {
+    /** Starting the backend library */
+    int backend_us;
+    /** Opening the window */
+    int window_us;
+    /** Creating the renderer */
+    int renderer_us;
+    /** Preparing the font */
+    int font_us;
+    /** Allocating the screen buffers */
+    int buffers_us;
+    /** Whole sodna_init() call */
+    int total_us;
+} sodna_StartupTimes;
+
+/**
+ * Get the startup time breakdown of the last sodna_init() call.
+ *
+ * Stages that weren't reached due to an error are reported as 0.
+ */
+void sodna_startup_times(sodna_StartupTimes* out_times);
+
+/**
+ * Change the font of a running terminal.
+ *
+ * The window is resized to fit the grid with the new character size, or,
+ * if the grid follows the window size, the grid is resized to fit the
+ * window. The screen is repainted once.
+ *
+ * \param font Font sheet to use, or null for the default Sodna font.
+ *
+ * \return SODNA_OK or SODNA_ERROR if the font is invalid or the terminal
+ * isn't running.
+ */
+sodna_Error sodna_set_font(const sodna_Font* font);
+
+/**
+ * Change the font of a running terminal to a font sheet with more than
+ * 256 characters, for use with SODNA_CELLS_WIDE cells.
+ *
+ * Only the first 256 characters are processed right away. The rest are
+ * expanded from the sheet 256 characters at a time when a cell first
+ * uses one of them, so the font must stay allocated and unchanged while it
+ * is in use. Symbols past the end of the font are shown as symbol 0.
+ *
+ * \param num_glyphs Number of characters in the row-major font sheet,
+ * between 256 and 65536.
+ *
+ * \return SODNA_OK or SODNA_ERROR if the font is invalid or the terminal
+ * isn't running.
+ */
+sodna_Error sodna_set_large_font(const sodna_Font* font, int num_glyphs);
+
+/**
+ * Expand a font ahead of time so that sodna_init() or sodna_set_font()
+ * can switch to it without processing the font sheet again.
+ *
+ * Registered fonts are recognized by their address and stay registered
+ * until sodna_exit(). Keep the font data unchanged and allocated while it
+ * is registered.
+ *
+ * \return SODNA_OK or SODNA_ERROR if the font is invalid or too many
+ * fonts have been registered.
+ */
+sodna_Error sodna_register_font(const sodna_Font* font);
+
+/**
+ * Use a pre-baked font.
+ *
+ * The glyph data is used in place without copying, so the font must stay
+ * allocated until another font is set or the terminal is shut down. Fonts
+ * with more than 256 glyphs can be used with SODNA_CELLS_WIDE cells, and
+ * the glyphs past the first 256 are only accessed when a cell uses them. If
+ * called before sodna_init(), the baked font is used when sodna_init() is
+ * called without a custom font.
+ *
+ * \return SODNA_OK or SODNA_ERROR if the font data is not valid.
+ */
+sodna_Error sodna_set_baked_font(const sodna_BakedFont* font);
+
+/**
+ * Rasterize the font scaled up by an integer factor.
+ *
+ * Normally the screen is scaled to the window by the renderer. With a
+ * scaled font the screen is drawn at the window resolution and presented
+ * as is, which is cheaper with software rendering and always pixel-perfect.
+ * The window is resized to fit the scaled grid unless the grid follows the
+ * window size.
+ *
+ * \param scale Integer scale factor, or 0 to use the largest factor at
+ * which the grid fits in the window and update it whenever the window size
+ * changes. The automatic factor is not updated while the grid follows the
+ * window size, see sodna_set_auto_resize().
+ *
+ * \return SODNA_OK or SODNA_ERROR if the scale is invalid.
+ */
+sodna_Error sodna_set_font_scale(int scale);
+
 /**
  * Color data structure
  */
@@ -72,6 +222,16 @@ typedef struct {
     uint8_t b;
 } sodna_Color;
 
+/**
+ * Rectangle of cells
+ */
+typedef struct {
+    int x;
+    int y;
+    int w;
+    int h;
+} sodna_Rect;
+
 /**
  * Terminal cell data structure
  *
@@ -89,15 +249,384 @@ typedef struct {
  * Return the pointer to the screen memory of sodna_width() *
  * sodna_height() terminal cells.
  *
- * Write values to this memory to display things.
+ * Write values to this memory to display things. Returns null if the
+ * screen memory is not in the SODNA_CELLS_RGB format.
  */
 sodna_Cell* sodna_cells();
 
+/**
+ * Layouts for the screen memory
+ */
+typedef enum {
+    /** sodna_Cell with 24-bit colors, the default */
+    SODNA_CELLS_RGB = 0,
+    /** sodna_PaletteCell with colors from a 256 color palette */
+    SODNA_CELLS_PALETTE = 1,
+    /** sodna_CompactCell with 12-bit colors */
+    SODNA_CELLS_COMPACT = 2,
+    /** sodna_WideCell with 16-bit symbols */
+    SODNA_CELLS_WIDE = 3,
+} sodna_CellFormat;
+
+/**
+ * Palette terminal cell data structure
+ *
+ * The foreground and background colors are indices to the palette set
+ * with sodna_set_palette_entry().
+ */
+typedef struct {
+    uint8_t fore;
+    uint8_t back;
+    uint8_t symbol;
+    uint8_t reserved;
+} sodna_PaletteCell;
+
+/**
+ * Compact terminal cell data structure
+ *
+ * The colors are 12-bit 0xRGB values, with each 4-bit component scaled
+ * to the full 8-bit range when displayed. The whole cell fits in 32 bits,
+ * for grids too large to scan comfortably with sodna_Cell.
+ */
+typedef struct {
+    unsigned int symbol: 8;
+    unsigned int fore: 12;
+    unsigned int back: 12;
+} sodna_CompactCell;
+
+/**
+ * Wide symbol terminal cell data structure
+ *
+ * Like sodna_Cell, but with a 16-bit symbol for fonts with more than 256
+ * glyphs. See sodna_set_large_font() and sodna_set_baked_font().
+ */
+typedef struct {
+    sodna_Color fore;
+    sodna_Color back;
+    uint16_t symbol;
+} sodna_WideCell;
+
+/**
+ * Set the layout of the screen memory.
+ *
+ * Can be called before sodna_init(). Changing the format of a running
+ * terminal clears the screen memory. The screen memory is accessed with
+ * the accessor function of the current format, the accessors of the other
+ * formats return null.
+ *
+ * \return SODNA_OK or SODNA_UNSUPPORTED if the format is unknown.
+ */
+sodna_Error sodna_set_cell_format(sodna_CellFormat format);
+
+/**
+ * Return the pointer to the screen memory when using
+ * SODNA_CELLS_PALETTE.
+ */
+sodna_PaletteCell* sodna_palette_cells();
+
+/**
+ * Return the pointer to the screen memory when using
+ * SODNA_CELLS_COMPACT.
+ */
+sodna_CompactCell* sodna_compact_cells();
+
+/**
+ * Return the pointer to the screen memory when using SODNA_CELLS_WIDE.
+ */
+sodna_WideCell* sodna_wide_cells();
+
+/**
+ * Location of one field of the cells in a caller-owned buffer
+ */
+typedef struct {
+    /** Address of the field of the top left cell */
+    const void* data;
+    /** Bytes from a cell to the next one on the same row */
+    int cell_stride;
+    /** Bytes from a cell to the one below it */
+    int row_stride;
+} sodna_FieldLayout;
+
+/**
+ * Layout of a caller-owned cell buffer
+ *
+ * The fields can point into an array of structs or into separate arrays.
+ */
+typedef struct {
+    /** sodna_Color foreground colors */
+    sodna_FieldLayout fore;
+    /** sodna_Color background colors */
+    sodna_FieldLayout back;
+    /** Symbols, in native byte order if 16-bit */
+    sodna_FieldLayout symbol;
+    /** Size of a symbol in bytes, 1 or 2 */
+    int symbol_size;
+    /** Number of columns in the buffer */
+    int columns;
+    /** Number of rows in the buffer */
+    int rows;
+} sodna_CellLayout;
+
+/**
+ * Display cells from a caller-owned buffer instead of the screen memory.
+ *
+ * sodna_flush() reads the cells straight from the buffer, so there's no
+ * need to copy them into the screen memory every frame. The buffer must
+ * stay valid while it is bound. Cells outside the buffer's columns and rows
+ * are shown blank.
+ *
+ * \param layout Layout of the buffer, or null to go back to displaying
+ * the screen memory. The layout is copied.
+ *
+ * \return SODNA_OK or SODNA_ERROR if the layout is invalid.
+ */
+sodna_Error sodna_bind_cells(const sodna_CellLayout* layout);
+
+/**
+ * Change a color in the palette used by SODNA_CELLS_PALETTE cells.
+ *
+ * Only the cells that use the entry will be redrawn on the next
+ * sodna_flush(), so cycling palette colors is cheap. The palette starts out
+ * as the xterm 256 color palette.
+ */
+void sodna_set_palette_entry(uint8_t index, sodna_Color color);
+
+/** Number of cell layers, including the screen memory at layer 0 */
+#define SODNA_MAX_LAYERS 8
+
+/**
+ * Ways of combining a layer with the layers under it
+ */
+typedef enum {
+    /** Cells with a nonzero symbol replace the cells under them */
+    SODNA_LAYER_NORMAL = 0,
+    /** Cells with a nonzero symbol replace the symbol and the foreground
+     * color, the background shows through */
+    SODNA_LAYER_GLYPH = 1,
+    /** The colors under the layer are multiplied by the cell colors, white
+     * cells leave them as they are */
+    SODNA_LAYER_MULTIPLY = 2,
+    /** The cell colors are added to the colors under the layer, black cells
+     * leave them as they are */
+    SODNA_LAYER_ADD = 3,
+} sodna_LayerMode;
+
+/**
+ * Return the cells of a layer drawn over the screen memory.
+ *
+ * Layers 1 to SODNA_MAX_LAYERS - 1 are stacked over the screen memory in
+ * order and composited on sodna_flush(). A layer is created blank and in
+ * SODNA_LAYER_NORMAL mode the first time it's asked for. Layers work with
+ * every cell format, but are always made of sodna_Cell. Only rows where a
+ * layer or the screen memory changed get composited again, and the layers
+ * under a cell of an opaque SODNA_LAYER_NORMAL layer are skipped.
+ *
+ * \param layer Layer index, 0 returns sodna_cells().
+ *
+ * \return The sodna_width() * sodna_height() cells of the layer or null if
+ * it couldn't be created.
+ */
+sodna_Cell* sodna_layer_cells(int layer);
+
+/**
+ * Set how a layer is combined with the layers under it.
+ *
+ * \param opacity How much the layer's colors count, 0 leaves the colors
+ * under the layer as they are and 255 uses the result of the mode as is.
+ *
+ * \return SODNA_OK or SODNA_ERROR if the layer hasn't been created with
+ * sodna_layer_cells().
+ */
+sodna_Error sodna_set_layer_mode(int layer, sodna_LayerMode mode, uint8_t opacity);
+
+/**
+ * Remove a layer and free its cells.
+ */
+void sodna_remove_layer(int layer);
+
+/**
+ * Return the light of each cell, multiplied into the cell colors when they
+ * are drawn.
+ *
+ * The lights are sodna_width() * sodna_height() colors, created white so
+ * that they leave the cells as they are the first time they're asked for.
+ * Cells are lit after the layers are composited. The lights are tracked
+ * apart from the cells, so a lighting change only redraws the cells whose
+ * light changed and the cells keep their unlit colors.
+ *
+ * \return The lights or null if they couldn't be created.
+ */
+sodna_Color* sodna_light_cells();
+
+/**
+ * Stop lighting the cells and free the lights.
+ */
+void sodna_remove_light_cells();
+
+/** Number of highlights drawn under the cursor */
+#define SODNA_MAX_HIGHLIGHTS 8
+
+/**
+ * Ways of marking cells with the cursor or a highlight
+ */
+typedef enum {
+    /** The cells are left as they are */
+    SODNA_OVERLAY_HIDDEN = 0,
+    /** The foreground and background colors of the cells are swapped */
+    SODNA_OVERLAY_INVERT = 1,
+    /** The background color of the cells is replaced with the overlay
+     * color */
+    SODNA_OVERLAY_BACK = 2,
+} sodna_OverlayStyle;
+
+/**
+ * Show the cursor at a cell, or hide it with SODNA_OVERLAY_HIDDEN.
+ *
+ * The cursor and the highlights are drawn over the cells after the layers
+ * are composited and the cells are lit, and the cells themselves don't
+ * change. Moving, restyling or blinking the cursor only redraws the cells
+ * it leaves and enters on the next sodna_flush().
+ *
+ * \param color Used by SODNA_OVERLAY_BACK, ignored otherwise.
+ */
+void sodna_set_cursor(int x, int y, sodna_OverlayStyle style, sodna_Color color);
+
+/**
+ * Highlight a rectangle of cells, for example a selection or the cell
+ * under the mouse. Works like the cursor, with higher indices drawn over
+ * lower ones.
+ *
+ * \param index Highlight from 0 to SODNA_MAX_HIGHLIGHTS - 1.
+ * \param rect Cells to highlight, or null to remove the highlight.
+ *
+ * \return SODNA_OK or SODNA_ERROR if the index is out of range.
+ */
+sodna_Error sodna_set_highlight(int index, const sodna_Rect* rect,
+        sodna_OverlayStyle style, sodna_Color color);
+
 /**
  * Display the terminal with the changes.
  */
 void sodna_flush();
 
+/**
+ * Display the terminal with the changes inside a rectangle of cells.
+ *
+ * Only the cells in the rectangle are checked for changes and only their
+ * pixels are uploaded, which makes small updates like a blinking cursor or
+ * a status line cheap. Changes outside the rectangle show up on the next
+ * sodna_flush(). Falls back to a full sodna_flush() when the whole screen
+ * needs to be redrawn, e.g. after a font change.
+ */
+void sodna_flush_rect(int x, int y, int w, int h);
+
+/**
+ * Limit the work a single sodna_flush() does.
+ *
+ * A flush stops drawing after max_cells cells or after max_us microseconds,
+ * whichever comes first. Zero or less disables a limit. The changes that
+ * didn't fit stay pending and get drawn by the next flushes, so a huge
+ * repaint gets spread over several frames instead of stalling one. Both
+ * limits are off by default.
+ */
+void sodna_set_flush_budget(int max_cells, int max_us);
+
+/**
+ * Set the cell whose surroundings get drawn first when a flush budget runs
+ * out, usually the cursor or the player. Rows are drawn outwards from the
+ * focus row and cells outwards from the focus column. A position outside the
+ * screen, like the default (-1, -1), draws top to bottom.
+ */
+void sodna_set_flush_focus(int x, int y);
+
+/**
+ * Return whether the last sodna_flush() drew all of the changes. If it
+ * didn't, keep flushing to finish the frame.
+ */
+int sodna_frame_complete();
+
+/**
+ * Move the contents of a rectangle of cells.
+ *
+ * The cells are moved along with their already rasterized pixels, so the
+ * next sodna_flush() only needs to draw the cells that were exposed. Cells
+ * moved outside the rectangle are dropped.
+ *
+ * \param rect Cells to scroll, or null for the whole screen.
+ * \param dx Columns to move the contents right, negative to move left.
+ * \param dy Rows to move the contents down, negative to move up.
+ * \param fill_cell A cell in the current cell format to fill the exposed
+ * cells with, or null for zeroed cells.
+ *
+ * \return SODNA_OK, SODNA_ERROR if the terminal isn't running or
+ * SODNA_UNSUPPORTED if displaying cells bound with sodna_bind_cells().
+ */
+sodna_Error sodna_scroll(const sodna_Rect* rect, int dx, int dy, const void* fill_cell);
+
+/**
+ * Save the screen memory on a stack, e.g. before drawing a modal dialog.
+ *
+ * The screen is saved in tiles, and tiles that haven't changed since the
+ * previous saved screen are shared with it instead of copied.
+ */
+sodna_Error sodna_push_screen();
+
+/**
+ * Restore the screen memory saved by the last sodna_push_screen().
+ *
+ * Only the tiles that changed since the push get copied back, so only they
+ * get redrawn on the next sodna_flush().
+ *
+ * \return SODNA_OK, or SODNA_ERROR if there is no saved screen or the grid
+ * size or cell format changed since it was saved. The saved screen is
+ * dropped in either case.
+ */
+sodna_Error sodna_pop_screen();
+
+/**
+ * Queue filling a rectangle with a cell.
+ *
+ * The queued drawing commands are run in order on the next sodna_flush(),
+ * one row of cells at a time. Adjacent fills of the same cell are merged and
+ * commands that a later fill or blit covers completely are skipped. The
+ * commands draw on the SODNA_CELLS_RGB screen memory and are dropped if it
+ * is in another format at flush time or the screen is resized.
+ */
+sodna_Error sodna_queue_fill(const sodna_Rect* rect, sodna_Cell cell);
+
+/**
+ * Queue writing a string with the given colors, starting from (x, y).
+ *
+ * The string is copied and isn't wrapped to the next row.
+ */
+sodna_Error sodna_queue_print(
+        int x, int y, const char* text, sodna_Color fore, sodna_Color back);
+
+/**
+ * Queue copying a rectangle of cells to the screen.
+ *
+ * \param cells Source cells, must stay unchanged until the next flush.
+ * \param pitch Number of cells from the start of one source row to the
+ * next.
+ * \param src_rect The source cells to copy.
+ */
+sodna_Error sodna_queue_blit(
+        const sodna_Cell* cells, int pitch, const sodna_Rect* src_rect,
+        int dest_x, int dest_y);
+
+/**
+ * Queue changing the colors of a rectangle, leaving the symbols as they
+ * are.
+ */
+sodna_Error sodna_queue_recolor(
+        const sodna_Rect* rect, sodna_Color fore, sodna_Color back);
+
+/**
+ * Queue drawing the outline of a rectangle with codepage 437 single line
+ * box characters, leaving the inside as it is.
+ */
+sodna_Error sodna_queue_box(const sodna_Rect* rect, sodna_Color fore, sodna_Color back);
+
 /**
  * Shut down the running terminal.
  */
@@ -113,11 +642,45 @@ int sodna_width();
  */
 int sodna_height();
 
+/**
+ * Change the number of columns and rows of a running terminal.
+ *
+ * The window and the rendering context are kept, only the cell and pixel
+ * buffers are reallocated. The overlapping top-left part of the old cells
+ * is preserved and the new cells are cleared. Pointers from earlier
+ * sodna_cells() calls become invalid. The screen is repainted once.
+ *
+ * \return SODNA_OK or SODNA_ERROR if the size is invalid or the
+ * terminal isn't running.
+ */
+sodna_Error sodna_resize(int num_columns, int num_rows);
+
+/**
+ * Toggle resizing the grid to fill the window, 1 to follow window size
+ * changes, 0 to keep the grid size fixed and scale it to the window.
+ *
+ * When enabled, the grid is resized right away and every time the user
+ * resizes the window. A SODNA_EVENT_RESIZED event is sent when the grid
+ * size changes.
+ */
+void sodna_set_auto_resize(int is_auto_resize);
+
 /**
  * Set the color of the edges around the cells.
  */
 void sodna_set_edge_color(sodna_Color color);
 
+/**
+ * Blend the whole displayed screen towards a color, alpha 0 shows the cells
+ * as they are and 255 shows only the tint color.
+ *
+ * The tint is applied by the renderer when the screen is presented. The
+ * cells are not rasterized again, so stepping alpha once per frame for a
+ * fade only costs a sodna_flush with no cell changes per step. The tint is
+ * not part of the pixels seen by sodna_dump_screenshot.
+ */
+void sodna_set_global_tint(sodna_Color color, uint8_t alpha);
+
 /**
  * Toggle fullscreen mode, 1 for fullscreen, 0 for windowed
  *
@@ -219,6 +782,14 @@ typedef union {
 #define SODNA_EVENT_MOUSE_ENTER     0x08
 #define SODNA_EVENT_MOUSE_EXIT      0x88
 
+/*
+ * No parameters, query sodna_width() and sodna_height() for the new size.
+ * The screen memory is reallocated on resize, so get sodna_cells() again.
+ * Resizes that happen while sodna_flush() drains the event queue are
+ * reported by the next sodna_poll_event() or sodna_wait_event().
+ */
+#define SODNA_EVENT_RESIZED         0x09
+
 /**
  * Wait for an input event.
  *
@@ -264,6 +835,78 @@ sodna_Error sodna_sleep_ms(int ms);
  */
 size_t sodna_dump_screenshot(uint8_t* out_pixels, int* out_width, int* out_height);
 
+/**
+ * Pixel layouts for sodna_render_to()
+ */
+typedef enum {
+    /** 32-bit 0xAARRGGBB pixels */
+    SODNA_PIXELS_ARGB8888 = 0,
+    /** 32-bit 0xAABBGGRR pixels, R, G, B, A bytes on little-endian systems */
+    SODNA_PIXELS_ABGR8888 = 1,
+    /** 16-bit pixels with 5 bits of red, 6 of green and 5 of blue */
+    SODNA_PIXELS_RGB565 = 2,
+} sodna_PixelFormat;
+
+/**
+ * Rasterize cells into user-provided memory.
+ *
+ * Uses the current font and cells like sodna_flush(), but writes to the
+ * given pixels instead of the window and doesn't affect what is shown in
+ * the window. The pixel at \a pixels is the top left corner of the
+ * rectangle.
+ *
+ * \param pitch Bytes from the start of a row of pixels to the next.
+ * \param rect Cells to rasterize, or null for the whole screen. The area
+ * is clipped to the screen, and the pixels of the parts off the screen
+ * are left as they are.
+ *
+ * \return SODNA_OK or SODNA_ERROR if the format is unknown or the
+ * terminal isn't running.
+ */
+sodna_Error sodna_render_to(
+        void* pixels, int pitch, sodna_PixelFormat format, const sodna_Rect* rect);
+
+/**
+ * Get the pixel format the screen is rasterized in.
+ *
+ * Sodna rasterizes in the window's native format when the backend supports
+ * it, to avoid converting the pixels when displaying them.
+ */
+sodna_PixelFormat sodna_pixel_format();
+
+/**
+ * Post-processing effect run on rasterized pixels before they are shown.
+ *
+ * Modifies the \a rect pixel rectangle of \a pixels in place. The pixels
+ * hold the whole screen, \a width by \a height pixels with rows \a pitch
+ * bytes apart, so effects can depend on the screen position.
+ *
+ * The effect only sees the parts of the screen that are uploaded, and
+ * always gets the freshly rasterized pixels, never its own earlier output.
+ */
+typedef void (*sodna_PostProcess)(
+        void* data, uint8_t* pixels, int pitch, sodna_PixelFormat format,
+        const sodna_Rect* rect, int width, int height);
+
+/**
+ * Run an effect on the rasterized screen before it is shown, or stop
+ * post-processing with a null \a effect.
+ *
+ * The screen pixels are sent through the effect again without being
+ * rasterized on the next flush. sodna_dump_screenshot() still returns the
+ * pixels without the effect. See sodna_util.h for built-in effects.
+ *
+ * \param data Passed to the effect as is.
+ *
+ * \return SODNA_OK or SODNA_ERROR if out of memory.
+ */
+sodna_Error sodna_set_post_process(sodna_PostProcess effect, void* data);
+
+/**
+ * Get the size of a cell in pixels.
+ */
+void sodna_char_size(int* out_width, int* out_height);
+
 /* Keyboard keys */
 #define SODNA_KEY_UNKNOWN          1
 #define SODNA_KEY_SPACE            2
@@ -0,0 +1,101 @@
+#ifndef _SODNA_INLINE_H
+#define _SODNA_INLINE_H
+
+/** \file sodna_inline.h */
+
+#include "sodna.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(_MSC_VER) && !defined(__cplusplus)
+#define SODNA_INLINE static __inline
+#else
+#define SODNA_INLINE static inline
+#endif
+
+/**
+ * Terminal descriptor for accessing the screen memory without function
+ * calls
+ */
+typedef struct {
+    /** Screen memory, null unless it is in the SODNA_CELLS_RGB format */
+    sodna_Cell* cells;
+    /** Width of the screen in columns */
+    int width;
+    /** Height of the screen in rows */
+    int height;
+    /** One flag per row, set by the put and fill helpers when they write
+     * on the row */
+    uint8_t* dirty_rows;
+} sodna_Terminal;
+
+/**
+ * Return the terminal descriptor.
+ *
+ * The pointer stays the same for the whole program. The fields are
+ * updated when the screen is initialized or resized or the cell format
+ * changes.
+ */
+const sodna_Terminal* sodna_terminal();
+
+/**
+ * Have sodna_flush() compare only the rows flagged in the dirty_rows of
+ * sodna_terminal().
+ *
+ * The flags are cleared when the rows get drawn. Only turn this on if all
+ * writes to the screen memory either go through the put and fill helpers
+ * or set the row flags themselves, other writes won't show up.
+ */
+void sodna_use_dirty_rows(int use_dirty_rows);
+
+SODNA_INLINE int sodna_term_width(const sodna_Terminal* term) {
+    return term->width;
+}
+
+SODNA_INLINE int sodna_term_height(const sodna_Terminal* term) {
+    return term->height;
+}
+
+/**
+ * Return the cell at (x, y). The position must be on the screen.
+ */
+SODNA_INLINE sodna_Cell sodna_term_get(const sodna_Terminal* term, int x, int y) {
+    return term->cells[y * term->width + x];
+}
+
+/**
+ * Set the cell at (x, y). The position must be on the screen.
+ */
+SODNA_INLINE void sodna_term_put(
+        const sodna_Terminal* term, int x, int y, sodna_Cell cell) {
+    term->cells[y * term->width + x] = cell;
+    term->dirty_rows[y] = 1;
+}
+
+/**
+ * Set the cells of a rectangle, clipped to the screen.
+ */
+SODNA_INLINE void sodna_term_fill(
+        const sodna_Terminal* term, int x, int y, int w, int h, sodna_Cell cell) {
+    int i, j;
+    if (x < 0) { w += x; x = 0; }
+    if (y < 0) { h += y; y = 0; }
+    if (x + w > term->width) w = term->width - x;
+    if (y + h > term->height) h = term->height - y;
+    if (w <= 0)
+        return;
+    for (j = y; j < y + h; j++) {
+        sodna_Cell* row = &term->cells[j * term->width];
+        for (i = x; i < x + w; i++)
+            row[i] = cell;
+        term->dirty_rows[j] = 1;
+    }
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
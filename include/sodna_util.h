@@ -26,6 +26,163 @@ int sodna_save_screenshot_png(const char* path);
  */
 int sodna_load_font(char* path, sodna_Font** out_font);
 
+/**
+ * Load a font sheet with more than 256 characters from an image file.
+ *
+ * The font sheet must be a row-major table 16 characters wide and as many
+ * rows tall as \a num_glyphs needs.
+ *
+ * \param num_glyphs Number of characters in the sheet, between 256 and
+ * 65536.
+ *
+ * \return \a SODNA_OK if successful, \a SODNA_ERROR otherwise.
+ */
+int sodna_load_font_sheet(char* path, int num_glyphs, sodna_Font** out_font);
+
+/**
+ * Save a font sheet as a baked font file.
+ *
+ * \param num_glyphs Number of characters to take from the font sheet in
+ * row-major order, at least 256.
+ *
+ * \return \a SODNA_OK if successful, \a SODNA_ERROR otherwise.
+ */
+int sodna_save_baked_font(const sodna_Font* font, int num_glyphs, const char* path);
+
+/**
+ * Map a baked font file into memory.
+ *
+ * The file is mapped read-only and shared, so the font data is not
+ * copied and processes using the same font file share the memory. Pass
+ * the font to sodna_set_baked_font() to use it.
+ *
+ * \param out_font The mapped font will be written here if successful.
+ * Release it with sodna_unmap_baked_font() when it is no longer used.
+ *
+ * \return \a SODNA_OK if successful, \a SODNA_ERROR otherwise.
+ */
+int sodna_map_baked_font(const char* path, const sodna_BakedFont** out_font);
+
+/**
+ * Release a font mapped with sodna_map_baked_font().
+ */
+void sodna_unmap_baked_font(const sodna_BakedFont* font);
+
+/**
+ * Grid of cells to draw into and blit around
+ *
+ * The cell at (x, y) is cells[y * pitch + x].
+ */
+typedef struct {
+    int width;
+    int height;
+    /** Number of cells from the start of one row to the next */
+    int pitch;
+    sodna_Cell* cells;
+} sodna_Canvas;
+
+/**
+ * Create an off-screen canvas of blank cells.
+ *
+ * The canvas and its cells are a single allocation, release it with
+ * free().
+ *
+ * \return The canvas or null if it couldn't be allocated.
+ */
+sodna_Canvas* sodna_new_canvas(int width, int height);
+
+/**
+ * Return a canvas that draws on sodna_cells().
+ *
+ * The canvas has no cells if the screen isn't in the SODNA_CELLS_RGB
+ * format. Get a new one after the screen has been resized.
+ */
+sodna_Canvas sodna_screen_canvas();
+
+/** Skip source cells with the same symbol as the key cell. */
+#define SODNA_BLIT_SYMBOL_KEY 0x01
+/** Keep the destination background under source cells with the same
+ * background color as the key cell. */
+#define SODNA_BLIT_BACK_KEY 0x02
+
+/**
+ * Copy a rectangle of cells from one canvas to another.
+ *
+ * The rectangle is clipped to both canvases. The canvases may overlap.
+ *
+ * \param src_rect The cells to copy, null for the whole source canvas.
+ * \param flags Zero for plain copying, or a combination of
+ * SODNA_BLIT_SYMBOL_KEY and SODNA_BLIT_BACK_KEY to leave parts of the
+ * destination showing through.
+ * \param key The cell matched against with the key flags.
+ */
+void sodna_blit(
+        const sodna_Canvas* src, const sodna_Rect* src_rect,
+        sodna_Canvas* dest, int dest_x, int dest_y,
+        int flags, sodna_Cell key);
+
+/**
+ * Copy a rectangle of cells to another place on the same canvas.
+ */
+void sodna_copy_rect(sodna_Canvas* canvas, const sodna_Rect* rect, int dest_x, int dest_y);
+
+/**
+ * Set every cell of a rectangle, clipped to the canvas.
+ *
+ * \param rect The cells to fill, null for the whole canvas.
+ */
+void sodna_fill_rect(sodna_Canvas* canvas, const sodna_Rect* rect, sodna_Cell cell);
+
+/**
+ * Change the colors of a rectangle, leaving the symbols as they are.
+ *
+ * \param rect The cells to recolor, null for the whole canvas.
+ */
+void sodna_recolor_rect(sodna_Canvas* canvas, const sodna_Rect* rect,
+        sodna_Color fore, sodna_Color back);
+
+/**
+ * Scale the colors of a rectangle towards black.
+ *
+ * \param rect The cells to darken, null for the whole canvas.
+ * \param brightness How much of the colors is left, 255 leaves them as
+ * they are and 0 turns them black.
+ */
+void sodna_darken_rect(sodna_Canvas* canvas, const sodna_Rect* rect, uint8_t brightness);
+
+/**
+ * Scanline effect for sodna_set_post_process(), darkens every other row
+ * of pixels.
+ *
+ * \param data Points to a uint8_t brightness of the darkened rows, 255
+ * leaves them as they are and 0 turns them black.
+ */
+void sodna_post_scanlines(
+        void* data, uint8_t* pixels, int pitch, sodna_PixelFormat format,
+        const sodna_Rect* rect, int width, int height);
+
+/**
+ * Vignette effect for sodna_set_post_process(), darkens the screen towards
+ * the corners.
+ *
+ * \param data Points to a uint8_t strength, how much darker the corners
+ * get, 0 for not at all and 255 for black.
+ */
+void sodna_post_vignette(
+        void* data, uint8_t* pixels, int pitch, sodna_PixelFormat format,
+        const sodna_Rect* rect, int width, int height);
+
+/**
+ * Color grading effect for sodna_set_post_process(), scales the red, green
+ * and blue channels separately.
+ *
+ * \param data Points to a sodna_Color of channel gains, 255 leaves a
+ * channel as it is and 0 removes it.
+ */
+void sodna_post_grade(
+        void* data, uint8_t* pixels, int pitch, sodna_PixelFormat format,
+        const sodna_Rect* rect, int width, int height);
+
 #ifdef __cplusplus
 }
 #endif
@@ -1,3 +1,8 @@
+newoption {
+    trigger = "track-writes",
+    description = "Track writes to the screen memory with page protection (Linux)"
+}
+
 solution "sodna"
     configurations { "Debug", "Release" }
 
@@ -21,6 +26,9 @@ solution "sodna"
             buildoptions { "`sdl2-config --cflags`" }
             linkoptions { "`sdl2-config --libs`" }
 
+        configuration { "linux", "track-writes" }
+            defines { "SODNA_TRACK_WRITES" }
+
     project "sodna-demo"
         kind "WindowedApp"
         language "C"
@@ -44,3 +52,27 @@ solution "sodna"
         configuration { "linux" }
             buildoptions { "`sdl2-config --cflags`" }
             linkoptions { "`sdl2-config --libs`", "-Wl,-rpath=." }
+
+    project "sodna-bake-font"
+        kind "ConsoleApp"
+        language "C"
+        files {
+            "tools/bake_font.c"
+        }
+
+        includedirs {
+            "include"
+        }
+
+        links {
+            "m",
+            "SDL2",
+            "sodna",
+        }
+
+        configuration { "windows" }
+            libdirs { "SDL2/lib-i686-w64-mingw32/" }
+
+        configuration { "linux" }
+            buildoptions { "`sdl2-config --cflags`" }
+            linkoptions { "`sdl2-config --libs`", "-Wl,-rpath=." }
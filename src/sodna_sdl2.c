@@ -1,63 +1,555 @@
 #include "sodna.h"
+#include "sodna_inline.h"
 #include <SDL.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <string.h>
 #include <math.h>
 
+/* Build with SODNA_TRACK_WRITES to have the screen memory write-protected
+ * between flushes, so that only the rows on the pages written into get
+ * compared. */
+#if defined(SODNA_TRACK_WRITES) && defined(__linux__)
+#define TRACK_WRITES
+#include <signal.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
 static SDL_Window* g_win = NULL;
 static SDL_Renderer* g_rend = NULL;
 static SDL_Texture* g_texture = NULL;
-static Uint32* g_pixels = NULL;
-static sodna_Cell* g_cells = NULL;
-static uint8_t* g_font = NULL;
+/* Rasterized screen in g_pixel_format. */
+static uint8_t* g_pixels = NULL;
+/* Post-processed copy of g_pixels that gets uploaded instead of it while a
+ * post-process effect is set. */
+static uint8_t* g_post_pixels = NULL;
+static sodna_PostProcess g_post_process = NULL;
+static void* g_post_data = NULL;
+static sodna_PixelFormat g_pixel_format = SODNA_PIXELS_ARGB8888;
+static int g_pixel_size = 4;
+static Uint32 g_texture_format = SDL_PIXELFORMAT_ARGB8888;
+/* Cell buffer in g_cell_format. */
+static uint8_t* g_cells = NULL;
+static sodna_CellFormat g_cell_format = SODNA_CELLS_RGB;
+static size_t g_cell_size = sizeof(sodna_Cell);
+/* Keys of the cells as they were last rasterized, see CELL_KEY. */
+static uint64_t* g_drawn = NULL;
+/* Keys of the row being flushed. */
+static uint64_t* g_row_keys = NULL;
+/* Whether the pixel buffer no longer matches g_drawn. */
+static int g_full_repaint = 1;
+/* Rows written into since they were last fetched, as far as page protection
+ * or the dirty rows of sodna_terminal() tell. */
+static uint8_t* g_written_rows = NULL;
+/* Whether the caller marks the dirty rows of every write. */
+static int g_use_dirty_rows = 0;
+static sodna_Terminal g_terminal;
+#ifdef TRACK_WRITES
+/* Screen memory that is write-protected, the write fault handler marks the
+ * page written and lets the write through. */
+static uint8_t* g_protected_cells = NULL;
+static size_t g_protected_size = 0;
+static uint8_t* g_written_pages = NULL;
+static size_t g_page_size = 0;
+static struct sigaction g_old_segv_action;
+static int g_segv_handler_is_set = 0;
+#endif
+/* Span of cell rows whose pixels haven't been uploaded to the texture. */
+static int g_first_dirty_row = -1;
+static int g_last_dirty_row = -1;
+/* Limits for a single sodna_flush(), 0 for no limit. */
+static int g_flush_max_cells = 0;
+static int g_flush_max_us = 0;
+static int g_flush_focus_x = -1;
+static int g_flush_focus_y = -1;
+static int g_frame_complete = 1;
+/* Whole-screen tint applied at present time, see sodna_set_global_tint. */
+static sodna_Color g_tint_color;
+static uint8_t g_tint_alpha = 0;
+/* Caller-owned cells displayed instead of g_cells if g_cells_are_bound. */
+static sodna_CellLayout g_bound_cells;
+static int g_cells_are_bound = 0;
+static uint32_t g_palette[256];
+static int g_palette_is_set = 0;
+
+typedef struct {
+    sodna_Cell* cells;
+    /* The cells as they were when last composited. */
+    sodna_Cell* composited;
+    sodna_LayerMode mode;
+    uint8_t opacity;
+} Layer;
+
+/* Layers over the screen memory, g_layers[0] is unused. */
+static Layer g_layers[SODNA_MAX_LAYERS];
+/* One past the highest layer with cells, 0 when there are none. */
+static int g_num_layers = 0;
+/* Screen memory saved with sodna_push_screen() in tiles of TILE_W x TILE_H
+ * cells. Snapshots share the tiles that didn't change between them. */
+#define TILE_W 16
+#define TILE_H 8
+
+typedef struct {
+    int refs;
+    uint8_t cells[];
+} Tile;
+
+typedef struct Snapshot {
+    struct Snapshot* prev;
+    int columns;
+    int rows;
+    sodna_CellFormat format;
+    Tile** tiles;
+} Snapshot;
+
+static Snapshot* g_snapshots = NULL;
+/* Tiles of the screen memory that may have been written since the latest
+ * snapshot was pushed, along with the rows still set in g_written_rows.
+ * Only meaningful while rows_are_tracked(). */
+static uint8_t* g_written_tiles = NULL;
+/* Drawing commands queued for the next flush. */
+typedef enum {
+    COMMAND_FILL,
+    COMMAND_PRINT,
+    COMMAND_BLIT,
+    COMMAND_RECOLOR,
+    COMMAND_BOX,
+} Command_Type;
+
+typedef struct {
+    Command_Type type;
+    /* The cells drawn on, clipped to the grid. */
+    sodna_Rect rect;
+    /* Unclipped outline of a box. */
+    sodna_Rect outline;
+    /* The fill cell, or the colors of the other commands. */
+    sodna_Cell cell;
+    /* Source of a blit, at the first cell of rect. */
+    const sodna_Cell* src;
+    int src_pitch;
+    /* Offset of printed text in g_command_text, at the first cell of rect. */
+    size_t text;
+    int is_culled;
+    /* Next command starting on the same row, -1 for none. */
+    int next;
+} Command;
+
+static Command* g_commands = NULL;
+static int g_num_commands = 0;
+static int g_commands_capacity = 0;
+/* First command starting on each row, and the commands on the row being
+ * run in queue order. */
+static int* g_command_rows = NULL;
+static int* g_active_commands = NULL;
+static char* g_command_text = NULL;
+static size_t g_command_text_size = 0;
+static size_t g_command_text_capacity = 0;
+/* Light multiplied into the cell colors when they are fetched, and the
+ * light as it was when the rows were last fetched. */
+static sodna_Color* g_light = NULL;
+static sodna_Color* g_fetched_light = NULL;
+/* Cursor and highlights applied to the cell keys when they are fetched. The
+ * highlights come first and the cursor is the last one, drawn over them. */
+typedef struct {
+    sodna_Rect rect;
+    sodna_OverlayStyle style;
+    uint32_t color;
+} Overlay;
+static Overlay g_overlays[SODNA_MAX_HIGHLIGHTS + 1];
+static int g_overlays_shown = 0;
+/* Composited keys of the grid, and the screen memory keys they were
+ * composited from. */
+static uint64_t* g_composed = NULL;
+static uint64_t* g_base_keys = NULL;
+/* Rows that must be composited again regardless of what changed. */
+static uint8_t* g_recompose_rows = NULL;
+/* Glyphs that are rasterized, either g_base_font or g_scaled_font. */
+static const uint8_t* g_font = NULL;
+/* Glyphs of the current font at their original size. */
+static const uint8_t* g_base_font = NULL;
+/* Whether g_base_font was allocated for the current font or belongs to a
+ * registered or baked font. */
+static int g_base_font_is_owned = 0;
+static uint8_t* g_scaled_font = NULL;
+/* Rasterized glyphs past the first 256 in pages of 256, expanded when a cell
+ * first uses them. Page 0 is g_font.
+ */
+static const uint8_t* g_pages[256];
+static uint8_t g_page_is_owned[256];
+/* Font sheet or baked glyph data the pages are loaded from. */
+static const sodna_Font* g_glyph_sheet = NULL;
+static const uint8_t* g_glyph_data = NULL;
+static int g_num_glyphs = 256;
 
 static int g_columns;
 static int g_rows;
+/* Size of the rasterized glyphs. */
 static int g_font_w;
 static int g_font_h;
+static int g_base_font_w;
+static int g_base_font_h;
+static int g_font_scale = 1;
+static int g_auto_font_scale = 0;
+static int g_auto_resize = 0;
+/* The grid was resized to fit the window while processing events, to be
+ * reported by the next sodna_poll_event() or sodna_wait_event(). */
+static int g_resize_pending = 0;
+static int g_init_flags = 0;
+static sodna_StartupTimes g_startup_times;
+
+/* Font sheet expanded to glyph-major layout ahead of time. */
+typedef struct {
+    const sodna_Font* source;
+    uint8_t* glyphs;
+} Expanded_Font;
+
+#define MAX_REGISTERED_FONTS 16
+static Expanded_Font g_registered_fonts[MAX_REGISTERED_FONTS];
+static int g_num_registered_fonts = 0;
 
 static sodna_Font default_font =
 #include "sodna_default_font.inc"
 ;
 
-static size_t font_offset(uint8_t symbol, int x, int y) {
-    return symbol * g_font_w * g_font_h + y * g_font_w + x;
+/* Pixel values for blending a foreground color over a background color at
+ * each coverage level of the font.
+ */
+typedef struct {
+    uint64_t colors;
+    Uint32 ramp[256];
+} Blend_Ramp;
+
+#define NUM_BLEND_RAMPS 256
+static Blend_Ramp* g_ramps = NULL;
+/* Coverage levels that occur in the current font. */
+static uint8_t g_levels[256];
+static uint8_t g_level_seen[256];
+static int g_num_levels = 0;
+
+/* Cells of every format are compared and rasterized as a 64-bit key of the
+ * 24-bit foreground and background colors and a 16-bit symbol.
+ */
+#define CELL_KEY(fore, back, symbol) \
+    ((uint64_t)(fore) << 40 | (uint64_t)(back) << 16 | (symbol))
+
+/* Stands in g_drawn for cells whose pixels are unknown. A real cell can only
+ * have this key as a white on white symbol 0xffff, which is then always
+ * treated as changed. */
+#define NEVER_DRAWN (~(uint64_t)0)
+
+static uint32_t rgb(sodna_Color color) {
+    return color.r << 16 | color.g << 8 | color.b;
 }
 
-static Uint32 convert_color(sodna_Color color) {
-    return 0xff000000 | color.r << 16 | color.g << 8 | color.b;
+/* Expand a 12-bit 0xRGB color into 24 bits. */
+static uint32_t rgb12(uint32_t c) {
+    return ((c & 0xf00) << 8 | (c & 0x0f0) << 4 | (c & 0x00f)) * 0x11;
 }
 
-static void grab_char(uint8_t c, const uint8_t* data, int pitch) {
+static Uint32 pixel_color(uint32_t rgb, sodna_PixelFormat format) {
+    switch (format) {
+        case SODNA_PIXELS_ABGR8888:
+            return 0xff000000 | (rgb & 0xff) << 16 | (rgb & 0xff00) | rgb >> 16;
+        case SODNA_PIXELS_RGB565:
+            return (rgb >> 8 & 0xf800) | (rgb >> 5 & 0x07e0) | (rgb >> 3 & 0x001f);
+        default:
+            return 0xff000000 | rgb;
+    }
+}
+
+/* Read a pixel back into a 24-bit color. */
+static uint32_t pixel_rgb(const uint8_t* pixel, sodna_PixelFormat format) {
+    Uint32 p;
+    Uint16 p16;
+    switch (format) {
+        case SODNA_PIXELS_ABGR8888:
+            memcpy(&p, pixel, 4);
+            return (p & 0xff) << 16 | (p & 0xff00) | (p >> 16 & 0xff);
+        case SODNA_PIXELS_RGB565:
+            memcpy(&p16, pixel, 2);
+            p = (p16 & 0xf800) << 8 | (p16 & 0x07e0) << 5 | (p16 & 0x001f) << 3;
+            /* Fill the low bits so that white stays white. */
+            return p | (p >> 5 & 0x070007) | (p >> 6 & 0x000300);
+        default:
+            memcpy(&p, pixel, 4);
+            return p & 0xffffff;
+    }
+}
+
+static int pixel_format_size(sodna_PixelFormat format) {
+    switch (format) {
+        case SODNA_PIXELS_ARGB8888:
+        case SODNA_PIXELS_ABGR8888:
+            return 4;
+        case SODNA_PIXELS_RGB565:
+            return 2;
+    }
+    return 0;
+}
+
+/* Copy a character from the font sheet into glyph-major layout. */
+static void grab_char(uint8_t* glyphs, uint8_t c, int w, int h,
+        const uint8_t* data, int pitch) {
     int x, y;
-    for (y = 0; y < g_font_h; y++) {
-        for (x = 0; x < g_font_w; x++) {
-            g_font[font_offset(c, x, y)] = data[y * pitch + x];
+    uint8_t* glyph = &glyphs[c * w * h];
+    for (y = 0; y < h; y++) {
+        for (x = 0; x < w; x++) {
+            glyph[y * w + x] = data[y * pitch + x];
         }
     }
 }
 
-static int init_font(const sodna_Font* font) {
-    int x = 0, row_offset = 0, c = 0;
+/* Copy a range of characters from a row-major font sheet into glyph-major
+ * layout.
+ */
+static void grab_chars(uint8_t* glyphs, const sodna_Font* font, int first, int count) {
     int columns = font->pitch / font->char_width;
+    int c;
+    for (c = 0; c < count; c++) {
+        int n = first + c;
+        size_t origin = (size_t)(n / columns) * font->char_height * font->pitch +
+            (n % columns) * font->char_width;
+        grab_char(glyphs, c, font->char_width, font->char_height,
+                &font->pixel_data[origin], font->pitch);
+    }
+}
+
+/* Expand a font sheet into a new glyph-major buffer of 256 characters. */
+static uint8_t* expand_font(const sodna_Font* font) {
+    uint8_t* glyphs;
     if (!font->char_height || !font->char_width || font->pitch < font->char_width)
-        return SODNA_ERROR;
+        return NULL;
 
-    free(g_font);
-    g_font = (uint8_t*)malloc(font->char_width * font->char_height * 256);
-    g_font_w = font->char_width;
-    g_font_h = font->char_height;
+    glyphs = (uint8_t*)malloc(font->char_width * font->char_height * 256);
+    if (!glyphs)
+        return NULL;
 
-    while (c < 256) {
-        for (x = 0; x < font->pitch; x += font->char_width) {
-            if (c >= 256)
-                break;
-            grab_char(c++, &font->pixel_data[row_offset + x], font->pitch);
+    grab_chars(glyphs, font, 0, 256);
+    return glyphs;
+}
+
+static const Expanded_Font* find_registered_font(const sodna_Font* font) {
+    int i;
+    for (i = 0; i < g_num_registered_fonts; i++)
+        if (g_registered_fonts[i].source == font)
+            return &g_registered_fonts[i];
+    return NULL;
+}
+
+/* Scale up a page of 256 glyphs from the base font size. */
+static void scale_glyphs(const uint8_t* src, uint8_t* dest, int scale) {
+    int c, x, y;
+    int src_size = g_base_font_w * g_base_font_h;
+    int w = g_base_font_w * scale, h = g_base_font_h * scale;
+    for (c = 0; c < 256; c++) {
+        for (y = 0; y < h; y++)
+            for (x = 0; x < w; x++)
+                dest[y * w + x] = src[(y / scale) * g_base_font_w + x / scale];
+        src += src_size;
+        dest += w * h;
+    }
+}
+
+static void clear_pages() {
+    int i;
+    for (i = 1; i < 256; i++) {
+        if (g_page_is_owned[i])
+            free((uint8_t*)g_pages[i]);
+        g_pages[i] = NULL;
+        g_page_is_owned[i] = 0;
+    }
+}
+
+/* Rasterize the font at an integer multiple of its size, so that the screen
+ * can be presented without the renderer scaling it.
+ */
+static void scale_font(int scale) {
+    int w = g_base_font_w * scale, h = g_base_font_h * scale;
+    free(g_scaled_font); g_scaled_font = NULL;
+    clear_pages();
+    g_full_repaint = 1;
+
+    if (scale > 1 && g_base_font)
+        g_scaled_font = (uint8_t*)malloc(w * h * 256);
+    if (!g_scaled_font) {
+        g_font = g_base_font;
+        g_font_scale = 1;
+        g_font_w = g_base_font_w;
+        g_font_h = g_base_font_h;
+        return;
+    }
+
+    scale_glyphs(g_base_font, g_scaled_font, scale);
+    g_font = g_scaled_font;
+    g_font_scale = scale;
+    g_font_w = w;
+    g_font_h = h;
+}
+
+/* Forget the cached blend ramps, eg. when the set of coverage levels changes.
+ * The ramps are allocated by sodna_init(). */
+static void reset_blend_ramps() {
+    int i;
+    /* No valid colors have the top bits set. */
+    for (i = 0; g_ramps && i < NUM_BLEND_RAMPS; i++)
+        g_ramps[i].colors = ~(uint64_t)0;
+}
+
+/* Add the coverage levels of the glyphs to g_levels. Return whether there
+ * were new ones.
+ */
+static int find_levels(const uint8_t* glyphs, size_t size) {
+    int found = 0;
+    size_t i;
+    for (i = 0; i < size; i++) {
+        if (!g_level_seen[glyphs[i]]) {
+            g_level_seen[glyphs[i]] = 1;
+            g_levels[g_num_levels++] = glyphs[i];
+            found = 1;
         }
-        row_offset += font->pitch * font->char_height;
     }
+    return found;
+}
+
+static void set_glyphs(const uint8_t* glyphs, int is_owned, int w, int h) {
+    if (g_base_font_is_owned)
+        free((uint8_t*)g_base_font);
+    g_base_font = glyphs;
+    g_base_font_is_owned = is_owned;
+    g_base_font_w = w;
+    g_base_font_h = h;
+    memset(g_level_seen, 0, sizeof(g_level_seen));
+    g_num_levels = 0;
+    if (glyphs)
+        find_levels(glyphs, w * h * 256);
+    reset_blend_ramps();
+    scale_font(g_font_scale);
+}
+
+/* Set where the glyphs past the first 256 are loaded from. */
+static void set_glyph_source(
+        const sodna_Font* sheet, const uint8_t* data, int num_glyphs) {
+    g_glyph_sheet = sheet;
+    g_glyph_data = data;
+    g_num_glyphs = num_glyphs;
+}
+
+/* Expand a page of glyphs of the current font when it is first used. */
+static const uint8_t* load_page(int page) {
+    int first = page * 256, count = g_num_glyphs - first, i;
+    size_t glyph_size = g_base_font_w * g_base_font_h;
+    uint8_t* base;
+    uint8_t* scaled;
+    if (count <= 0 || (!g_glyph_sheet && !g_glyph_data))
+        return NULL;
+    if (count > 256)
+        count = 256;
+
+    if (g_glyph_data && count == 256 && g_font_scale == 1) {
+        /* Whole pages of baked fonts can be used in place. */
+        g_pages[page] = &g_glyph_data[first * glyph_size];
+    } else {
+        base = (uint8_t*)malloc(256 * glyph_size);
+        if (!base)
+            return NULL;
+        if (g_glyph_data)
+            memcpy(base, &g_glyph_data[first * glyph_size], count * glyph_size);
+        else
+            grab_chars(base, g_glyph_sheet, first, count);
+        /* The rest of a partial last page shows as symbol 0. */
+        for (i = count; i < 256; i++)
+            memcpy(&base[i * glyph_size], g_base_font, glyph_size);
+
+        if (g_font_scale > 1) {
+            scaled = (uint8_t*)malloc(g_font_w * g_font_h * 256);
+            if (scaled)
+                scale_glyphs(base, scaled, g_font_scale);
+            free(base);
+            if (!scaled)
+                return NULL;
+            base = scaled;
+        }
+        g_pages[page] = base;
+        g_page_is_owned[page] = 1;
+    }
+
+    /* Cached ramps are missing any new coverage levels. */
+    if (find_levels(g_pages[page], g_font_w * g_font_h * 256))
+        reset_blend_ramps();
+    return g_pages[page];
+}
 
+static const uint8_t* glyph_data(unsigned symbol) {
+    const uint8_t* page = g_font;
+    if (symbol > 0xff) {
+        page = g_pages[symbol >> 8];
+        if (!page)
+            page = load_page(symbol >> 8);
+        /* Symbols the font doesn't have are shown as symbol 0. */
+        if (!page) {
+            page = g_font;
+            symbol = 0;
+        }
+    }
+    return &page[(symbol & 0xff) * g_font_w * g_font_h];
+}
+
+static int init_font(const sodna_Font* font) {
+    const Expanded_Font* registered = find_registered_font(font);
+    uint8_t* glyphs = registered ? registered->glyphs : expand_font(font);
+    if (!glyphs)
+        return SODNA_ERROR;
+
+    set_glyph_source(NULL, NULL, 256);
+    set_glyphs(glyphs, !registered, font->char_width, font->char_height);
+    return SODNA_OK;
+}
+
+/* Like init_font, but keep the font sheet for expanding more than 256
+ * glyphs from it later.
+ */
+static int init_large_font(const sodna_Font* font, int num_glyphs) {
+    uint8_t* glyphs;
+    if (num_glyphs < 256 || num_glyphs > 0x10000)
+        return SODNA_ERROR;
+    glyphs = expand_font(font);
+    if (!glyphs)
+        return SODNA_ERROR;
+
+    set_glyph_source(font, NULL, num_glyphs);
+    set_glyphs(glyphs, 1, font->char_width, font->char_height);
+    return SODNA_OK;
+}
+
+/* Baked fonts are already in glyph-major layout and are used in place. */
+static int init_baked_font(const sodna_BakedFont* font) {
+    const uint8_t* n = (const uint8_t*)&font->num_glyphs;
+    uint32_t num_glyphs = n[0] | n[1] << 8 | n[2] << 16 | (uint32_t)n[3] << 24;
+    if (memcmp(font->magic, SODNA_BAKED_FONT_MAGIC, 4) != 0 ||
+            font->version != SODNA_BAKED_FONT_VERSION ||
+            !font->char_width || !font->char_height || num_glyphs < 256)
+        return SODNA_ERROR;
+
+    set_glyph_source(NULL, font->glyph_data,
+            num_glyphs > 0x10000 ? 0x10000 : num_glyphs);
+    set_glyphs(font->glyph_data, 0, font->char_width, font->char_height);
+    return SODNA_OK;
+}
+
+sodna_Error sodna_register_font(const sodna_Font* font) {
+    Expanded_Font* entry;
+    if (find_registered_font(font))
+        return SODNA_OK;
+    if (g_num_registered_fonts >= MAX_REGISTERED_FONTS)
+        return SODNA_ERROR;
+
+    entry = &g_registered_fonts[g_num_registered_fonts];
+    entry->glyphs = expand_font(font);
+    if (!entry->glyphs)
+        return SODNA_ERROR;
+    entry->source = font;
+    g_num_registered_fonts++;
     return SODNA_OK;
 }
 
@@ -69,10 +561,399 @@ static int window_h() {
     return g_rows * g_font_h;
 }
 
+/* Find the Sodna pixel layout that matches an SDL pixel format. */
+static int pixel_format_for(Uint32 sdl_format, sodna_PixelFormat* out_format) {
+    switch (sdl_format) {
+        case SDL_PIXELFORMAT_ARGB8888:
+        case SDL_PIXELFORMAT_RGB888:
+            *out_format = SODNA_PIXELS_ARGB8888;
+            return 1;
+        case SDL_PIXELFORMAT_ABGR8888:
+        case SDL_PIXELFORMAT_BGR888:
+            *out_format = SODNA_PIXELS_ABGR8888;
+            return 1;
+        case SDL_PIXELFORMAT_RGB565:
+            *out_format = SODNA_PIXELS_RGB565;
+            return 1;
+    }
+    return 0;
+}
+
+/* Rasterize in the window's own pixel format when the renderer supports it,
+ * so that SDL doesn't need to convert the pixels when uploading them.
+ */
+static void choose_pixel_format() {
+    SDL_RendererInfo info;
+    Uint32 window_format = SDL_GetWindowPixelFormat(g_win);
+    sodna_PixelFormat format;
+    int i;
+
+    g_texture_format = SDL_PIXELFORMAT_ARGB8888;
+    g_pixel_format = SODNA_PIXELS_ARGB8888;
+    if (SDL_GetRendererInfo(g_rend, &info) == 0) {
+        for (i = 0; i < info.num_texture_formats; i++) {
+            if (info.texture_formats[i] == window_format &&
+                    pixel_format_for(window_format, &format)) {
+                g_texture_format = window_format;
+                g_pixel_format = format;
+                break;
+            }
+        }
+        /* Otherwise go with the renderer's preferred format. */
+        for (i = 0; i < info.num_texture_formats && g_texture_format != window_format; i++) {
+            if (pixel_format_for(info.texture_formats[i], &format)) {
+                g_texture_format = info.texture_formats[i];
+                g_pixel_format = format;
+                break;
+            }
+        }
+    }
+    g_pixel_size = pixel_format_size(g_pixel_format);
+}
+
+/* Scale the texture towards black by the tint alpha. The tint color itself
+ * is added over the copied texture in present(), so together they blend the
+ * frame towards the tint without touching g_pixels.
+ */
+static void apply_tint_mod() {
+    uint8_t keep = 255 - g_tint_alpha;
+    if (g_texture)
+        SDL_SetTextureColorMod(g_texture, keep, keep, keep);
+}
+
+/* (Re)create the pixel buffer and the texture to match the current grid and
+ * font dimensions.
+ */
+static int alloc_screen() {
+    SDL_DestroyTexture(g_texture); g_texture = NULL;
+    g_texture = SDL_CreateTexture(
+            g_rend, g_texture_format,
+            SDL_TEXTUREACCESS_STREAMING,
+            window_w(), window_h());
+    apply_tint_mod();
+
+    free(g_pixels); g_pixels = NULL;
+    g_pixels = (uint8_t*)malloc(window_w() * window_h() * g_pixel_size);
+    free(g_post_pixels); g_post_pixels = NULL;
+    if (g_post_process)
+        g_post_pixels = (uint8_t*)malloc(window_w() * window_h() * g_pixel_size);
+    g_full_repaint = 1;
+    /* Pending rows may be past the new size, the repaint covers them. */
+    g_first_dirty_row = g_last_dirty_row = -1;
+
+    return (g_texture && g_pixels && (g_post_pixels || !g_post_process)) ?
+        SODNA_OK : SODNA_ERROR;
+}
+
+static int tiles_across() {
+    return (g_columns + TILE_W - 1) / TILE_W;
+}
+
+static int num_tiles() {
+    return tiles_across() * ((g_rows + TILE_H - 1) / TILE_H);
+}
+
+/* (Re)create the change tracking buffers to match the current grid. */
+static int alloc_tracking() {
+    free(g_drawn);
+    g_drawn = (uint64_t*)malloc(g_columns * g_rows * sizeof(uint64_t));
+    free(g_row_keys);
+    g_row_keys = (uint64_t*)malloc(g_columns * sizeof(uint64_t));
+    g_full_repaint = 1;
+    free(g_written_rows);
+    g_written_rows = (uint8_t*)malloc(g_rows);
+    if (g_written_rows)
+        memset(g_written_rows, 1, g_rows);
+    free(g_command_rows);
+    g_command_rows = (int*)malloc(g_rows * sizeof(int));
+    free(g_written_tiles);
+    g_written_tiles = (uint8_t*)malloc(num_tiles());
+    if (g_written_tiles)
+        memset(g_written_tiles, 1, num_tiles());
+
+    return (g_drawn && g_row_keys && g_written_rows && g_command_rows &&
+            g_written_tiles) ?
+        SODNA_OK : SODNA_ERROR;
+}
+
+static void mark_all_rows_written() {
+    if (g_written_rows)
+        memset(g_written_rows, 1, g_rows);
+}
+
+/* Point the sodna_terminal() descriptor at the current screen memory. */
+static void update_terminal() {
+    g_terminal.cells = sodna_cells();
+    g_terminal.width = g_cells ? g_columns : 0;
+    g_terminal.height = g_cells ? g_rows : 0;
+    g_terminal.dirty_rows = g_written_rows;
+}
+
+#ifdef TRACK_WRITES
+static size_t page_size() {
+    if (!g_page_size)
+        g_page_size = sysconf(_SC_PAGESIZE);
+    return g_page_size;
+}
+
+/* Whole pages, so that protecting the screen memory leaves other
+ * allocations alone. */
+static size_t cells_alloc_size(int columns, int rows, size_t cell_size) {
+    size_t size = (size_t)columns * rows * cell_size;
+    return (size + page_size() - 1) / page_size() * page_size();
+}
+
+static uint8_t* alloc_cells(int columns, int rows, size_t cell_size) {
+    void* ret;
+    size_t size = cells_alloc_size(columns, rows, cell_size);
+    if (posix_memalign(&ret, page_size(), size))
+        return NULL;
+    memset(ret, 0, size);
+    return (uint8_t*)ret;
+}
+
+/* Stop tracking writes until the next flush. */
+static void unprotect_cells() {
+    if (g_protected_cells) {
+        mprotect(g_protected_cells, g_protected_size, PROT_READ | PROT_WRITE);
+        g_protected_cells = NULL;
+    }
+    mark_all_rows_written();
+}
+
+static void free_cells(uint8_t* cells) {
+    if (cells && cells == g_protected_cells)
+        unprotect_cells();
+    free(cells);
+}
+
+static void on_write_fault(int sig, siginfo_t* info, void* context) {
+    uint8_t* addr = (uint8_t*)info->si_addr;
+    if (g_protected_cells && addr >= g_protected_cells &&
+            addr < g_protected_cells + g_protected_size) {
+        size_t page = (addr - g_protected_cells) / g_page_size;
+        g_written_pages[page] = 1;
+        mprotect(g_protected_cells + page * g_page_size, g_page_size,
+                PROT_READ | PROT_WRITE);
+        return;
+    }
+    /* Not a screen memory write, the faulting instruction runs again and
+     * goes to the previous handler. */
+    sigaction(SIGSEGV, &g_old_segv_action, NULL);
+    g_segv_handler_is_set = 0;
+}
+
+static void restore_segv_handler() {
+    if (g_segv_handler_is_set)
+        sigaction(SIGSEGV, &g_old_segv_action, NULL);
+    g_segv_handler_is_set = 0;
+}
+
+/* Mark the rows on the pages written since the last call and protect the
+ * screen memory again to catch the next writes. */
+static void collect_written_pages() {
+    size_t page, num_pages;
+    size_t row_size = g_columns * g_cell_size;
+    size_t size = cells_alloc_size(g_columns, g_rows, g_cell_size);
+
+    num_pages = size / page_size();
+    if (g_protected_cells == g_cells && g_protected_size == size) {
+        for (page = 0; page < num_pages; page++) {
+            size_t y, last_y;
+            if (!g_written_pages[page])
+                continue;
+            last_y = ((page + 1) * g_page_size - 1) / row_size;
+            for (y = page * g_page_size / row_size; y <= last_y && y < g_rows; y++)
+                g_written_rows[y] = 1;
+        }
+    } else {
+        unprotect_cells();
+        free(g_written_pages);
+        g_written_pages = (uint8_t*)malloc(num_pages);
+        if (!g_written_pages)
+            return;
+    }
+    memset(g_written_pages, 0, num_pages);
+
+    if (!g_segv_handler_is_set) {
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_sigaction = on_write_fault;
+        action.sa_flags = SA_SIGINFO;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGSEGV, &action, &g_old_segv_action);
+        g_segv_handler_is_set = 1;
+    }
+    g_protected_cells = g_cells;
+    g_protected_size = size;
+    mprotect(g_cells, size, PROT_READ);
+}
+
+#else
+static uint8_t* alloc_cells(int columns, int rows, size_t cell_size) {
+    return (uint8_t*)calloc(columns * rows, cell_size);
+}
+
+static void free_cells(uint8_t* cells) { free(cells); }
+#endif
+
+/* Mark the rows whose light changed as written. */
+static void collect_light_changes() {
+    int y;
+    size_t row_size = g_columns * sizeof(sodna_Color);
+    for (y = 0; y < g_rows; y++) {
+        sodna_Color* light = &g_light[y * g_columns];
+        sodna_Color* fetched = &g_fetched_light[y * g_columns];
+        if (memcmp(light, fetched, row_size)) {
+            memcpy(fetched, light, row_size);
+            g_written_rows[y] = 1;
+        }
+    }
+}
+
+/* Get g_written_rows up to date for a flush. */
+static void collect_written_rows() {
+    if (g_light)
+        collect_light_changes();
+    /* The displayed cells don't come from the screen memory alone. */
+    if (g_cells_are_bound || g_num_layers) {
+#ifdef TRACK_WRITES
+        unprotect_cells();
+#endif
+        mark_all_rows_written();
+        return;
+    }
+#ifdef TRACK_WRITES
+    collect_written_pages();
+#endif
+}
+
+/* Whether every write to the screen memory shows up in g_written_rows. */
+static int rows_are_tracked() {
+#ifdef TRACK_WRITES
+    if (g_protected_cells && g_protected_cells == g_cells)
+        return 1;
+#endif
+    return g_use_dirty_rows;
+}
+
+static int row_was_written(int y) {
+    return g_written_rows[y] || !rows_are_tracked();
+}
+
+/* (Re)create the layer compositing buffers to match the current grid. The
+ * layers' cells must already match it. */
+static int alloc_compositing() {
+    int i, ok = 1;
+    free(g_composed);
+    g_composed = (uint64_t*)malloc(g_columns * g_rows * sizeof(uint64_t));
+    free(g_base_keys);
+    g_base_keys = (uint64_t*)malloc(g_columns * g_rows * sizeof(uint64_t));
+    free(g_recompose_rows);
+    g_recompose_rows = (uint8_t*)malloc(g_rows);
+    for (i = 1; i < g_num_layers; i++) {
+        if (!g_layers[i].cells)
+            continue;
+        free(g_layers[i].composited);
+        g_layers[i].composited =
+            (sodna_Cell*)malloc(g_columns * g_rows * sizeof(sodna_Cell));
+        ok = ok && g_layers[i].composited;
+    }
+    if (g_recompose_rows)
+        memset(g_recompose_rows, 1, g_rows);
+
+    return (ok && g_composed && g_base_keys && g_recompose_rows) ?
+        SODNA_OK : SODNA_ERROR;
+}
+
+static void free_layer(Layer* layer) {
+    free(layer->cells); layer->cells = NULL;
+    free(layer->composited); layer->composited = NULL;
+}
+
+static void free_layers() {
+    int i;
+    for (i = 1; i < SODNA_MAX_LAYERS; i++)
+        free_layer(&g_layers[i]);
+    g_num_layers = 0;
+    free(g_composed); g_composed = NULL;
+    free(g_base_keys); g_base_keys = NULL;
+    free(g_recompose_rows); g_recompose_rows = NULL;
+}
+
+static void free_snapshot(Snapshot* snapshot) {
+    int i;
+    if (snapshot->tiles) {
+        int num_tiles = ((snapshot->columns + TILE_W - 1) / TILE_W) *
+            ((snapshot->rows + TILE_H - 1) / TILE_H);
+        for (i = 0; i < num_tiles; i++)
+            if (snapshot->tiles[i] && --snapshot->tiles[i]->refs == 0)
+                free(snapshot->tiles[i]);
+        free(snapshot->tiles);
+    }
+    free(snapshot);
+}
+
+static void free_snapshots() {
+    while (g_snapshots) {
+        Snapshot* prev = g_snapshots->prev;
+        free_snapshot(g_snapshots);
+        g_snapshots = prev;
+    }
+}
+
+/* Fill the palette with the xterm 256 color palette. */
+static void init_palette() {
+    static const uint8_t ansi[16][3] = {
+        {0, 0, 0}, {128, 0, 0}, {0, 128, 0}, {128, 128, 0},
+        {0, 0, 128}, {128, 0, 128}, {0, 128, 128}, {192, 192, 192},
+        {128, 128, 128}, {255, 0, 0}, {0, 255, 0}, {255, 255, 0},
+        {0, 0, 255}, {255, 0, 255}, {0, 255, 255}, {255, 255, 255}};
+    static const uint8_t cube[6] = {0, 95, 135, 175, 215, 255};
+    int i;
+    if (g_palette_is_set)
+        return;
+    for (i = 0; i < 16; i++)
+        g_palette[i] = ansi[i][0] << 16 | ansi[i][1] << 8 | ansi[i][2];
+    for (i = 0; i < 216; i++)
+        g_palette[16 + i] = cube[i / 36] << 16 | cube[i / 6 % 6] << 8 | cube[i % 6];
+    for (i = 0; i < 24; i++)
+        g_palette[232 + i] = (8 + i * 10) * 0x010101;
+    g_palette_is_set = 1;
+}
+
+static size_t cell_format_size(sodna_CellFormat format) {
+    switch (format) {
+        case SODNA_CELLS_RGB:
+            return sizeof(sodna_Cell);
+        case SODNA_CELLS_PALETTE:
+            return sizeof(sodna_PaletteCell);
+        case SODNA_CELLS_COMPACT:
+            return sizeof(sodna_CompactCell);
+        case SODNA_CELLS_WIDE:
+            return sizeof(sodna_WideCell);
+    }
+    return 0;
+}
+
+void sodna_set_init_flags(int flags) {
+    g_init_flags = flags;
+}
+
+/* Return microseconds since the counter value and update the counter. */
+static int lap_us(Uint64* counter) {
+    Uint64 now = SDL_GetPerformanceCounter();
+    int ret = (int)((now - *counter) * 1000000 / SDL_GetPerformanceFrequency());
+    *counter = now;
+    return ret;
+}
+
 sodna_Error sodna_init(
         int num_columns, int num_rows,
         const char* window_title,
         const sodna_Font* custom_font) {
+    Uint64 start, lap;
+    Uint32 subsystems = SDL_INIT_VIDEO | SDL_INIT_EVENTS;
     if (num_columns < 1 || num_rows < 1)
         return 1;
 
@@ -82,96 +963,774 @@ sodna_Error sodna_init(
 
     g_columns = num_columns;
     g_rows = num_rows;
+    memset(&g_startup_times, 0, sizeof(g_startup_times));
+    start = lap = SDL_GetPerformanceCounter();
 
-    if (SDL_Init(SDL_INIT_EVERYTHING) != 0)
+    /* The other subsystems can be slow to start and Sodna doesn't use
+     * them, so only start them when asked to.
+     */
+    if (g_init_flags & SODNA_INIT_ALL_SUBSYSTEMS)
+        subsystems = SDL_INIT_EVERYTHING;
+    if (SDL_Init(subsystems) != 0)
         return SODNA_ERROR;
+    g_startup_times.backend_us = lap_us(&lap);
 
     g_win = SDL_CreateWindow(
             window_title, SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
-            window_w(), window_h(), SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE);
+            window_w(), window_h(), SDL_WINDOW_RESIZABLE |
+            ((g_init_flags & SODNA_INIT_HIDDEN) ? SDL_WINDOW_HIDDEN : SDL_WINDOW_SHOWN));
     if (!g_win)
         return SODNA_ERROR;
+    g_startup_times.window_us = lap_us(&lap);
 
     g_rend = SDL_CreateRenderer(g_win, -1,
             SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
+    choose_pixel_format();
+    g_startup_times.renderer_us = lap_us(&lap);
 
-    init_font(custom_font ? custom_font : &default_font);
+    g_ramps = (Blend_Ramp*)malloc(NUM_BLEND_RAMPS * sizeof(Blend_Ramp));
+    if (!g_ramps)
+        return SODNA_ERROR;
+    reset_blend_ramps();
 
-    SDL_DestroyTexture(g_texture); g_texture = NULL;
-    g_texture = SDL_CreateTexture(
-            g_rend, SDL_PIXELFORMAT_ARGB8888,
-            SDL_TEXTUREACCESS_STREAMING,
-            window_w(), window_h());
+    /* Keep a baked font set before init unless told otherwise. */
+    if (custom_font || !g_font)
+        if (init_font(custom_font ? custom_font : &default_font) != SODNA_OK)
+            return SODNA_ERROR;
+    g_startup_times.font_us = lap_us(&lap);
 
+    if (alloc_screen() != SODNA_OK)
+        return SODNA_ERROR;
+
+    free_cells(g_cells); g_cells = NULL;
+    g_cells = alloc_cells(sodna_width(), sodna_height(), g_cell_size);
+    if (!g_cells || alloc_tracking() != SODNA_OK)
+        return SODNA_ERROR;
+    update_terminal();
+
+    SDL_SetWindowSize(g_win, window_w(), window_h());
+    /* Simple aspect-retaining scaling, but not pixel-perfect. */
+    /* SDL_RenderSetLogicalSize(g_rend, window_w(), window_h()); */
+    g_startup_times.buffers_us = lap_us(&lap);
+    g_startup_times.total_us = lap_us(&start);
+
+    return SODNA_OK;
+}
+
+void sodna_startup_times(sodna_StartupTimes* out_times) {
+    *out_times = g_startup_times;
+}
+
+void sodna_exit() {
+    int i;
+    SDL_DestroyRenderer(g_rend); g_rend = NULL;
+    SDL_DestroyWindow(g_win); g_win = NULL;
+    SDL_DestroyTexture(g_texture); g_texture = NULL;
     free(g_pixels); g_pixels = NULL;
-    g_pixels = (Uint32*)malloc(window_w() * window_h() * 4);
+    free(g_post_pixels); g_post_pixels = NULL;
+    free_cells(g_cells); g_cells = NULL;
+    free(g_drawn); g_drawn = NULL;
+    free(g_row_keys); g_row_keys = NULL;
+    free(g_written_rows); g_written_rows = NULL;
+    free(g_written_tiles); g_written_tiles = NULL;
+    update_terminal();
+#ifdef TRACK_WRITES
+    free(g_written_pages); g_written_pages = NULL;
+    restore_segv_handler();
+#endif
+    free_layers();
+    free_snapshots();
+    sodna_remove_light_cells();
+    free(g_commands); g_commands = NULL;
+    free(g_active_commands); g_active_commands = NULL;
+    free(g_command_rows); g_command_rows = NULL;
+    g_num_commands = g_commands_capacity = 0;
+    free(g_command_text); g_command_text = NULL;
+    g_command_text_size = g_command_text_capacity = 0;
+    g_cells_are_bound = 0;
+    set_glyphs(NULL, 0, 0, 0);
+    set_glyph_source(NULL, NULL, 256);
+    free(g_ramps); g_ramps = NULL;
+    g_font_scale = 1;
+    g_auto_font_scale = 0;
+    for (i = 0; i < g_num_registered_fonts; i++)
+        free(g_registered_fonts[i].glyphs);
+    g_num_registered_fonts = 0;
+    SDL_Quit();
+}
+
+/* Copy the overlapping top-left part of the grid into a blank grid of a
+ * different size. */
+static void copy_to_resized_grid(uint8_t* dest, const uint8_t* cells,
+        size_t cell_size, int num_columns, int num_rows) {
+    int y;
+    int copy_columns = num_columns < g_columns ? num_columns : g_columns;
+    int copy_rows = num_rows < g_rows ? num_rows : g_rows;
+    for (y = 0; y < copy_rows; y++)
+        memcpy(&dest[y * num_columns * cell_size],
+                &cells[y * g_columns * cell_size],
+                copy_columns * cell_size);
+}
+
+static void flush_changes();
+
+sodna_Error sodna_resize(int num_columns, int num_rows) {
+    int i;
+    uint8_t* cells;
+    sodna_Cell* layers[SODNA_MAX_LAYERS];
+    sodna_Color* light = NULL;
+    sodna_Color* fetched_light = NULL;
+    memset(layers, 0, sizeof(layers));
+    if (num_columns < 1 || num_rows < 1 || !g_win)
+        return SODNA_ERROR;
+    if (num_columns == g_columns && num_rows == g_rows)
+        return SODNA_OK;
+
+    cells = alloc_cells(num_columns, num_rows, g_cell_size);
+    if (!cells)
+        return SODNA_ERROR;
+    copy_to_resized_grid(cells, g_cells, g_cell_size, num_columns, num_rows);
+    for (i = 1; i < g_num_layers; i++) {
+        if (!g_layers[i].cells)
+            continue;
+        layers[i] = (sodna_Cell*)calloc(num_columns * num_rows, sizeof(sodna_Cell));
+        if (!layers[i]) {
+            while (--i > 0)
+                free(layers[i]);
+            free_cells(cells);
+            return SODNA_ERROR;
+        }
+        copy_to_resized_grid((uint8_t*)layers[i], (uint8_t*)g_layers[i].cells,
+                sizeof(sodna_Cell), num_columns, num_rows);
+    }
+
+    if (g_light) {
+        light = (sodna_Color*)malloc(num_columns * num_rows * sizeof(sodna_Color));
+        fetched_light = (sodna_Color*)malloc(num_columns * num_rows * sizeof(sodna_Color));
+        if (!light || !fetched_light) {
+            free(light);
+            free(fetched_light);
+            for (i = 1; i < g_num_layers; i++)
+                free(layers[i]);
+            free_cells(cells);
+            return SODNA_ERROR;
+        }
+        /* New cells start out unlit, i.e. white. */
+        memset(light, 0xff, num_columns * num_rows * sizeof(sodna_Color));
+        copy_to_resized_grid((uint8_t*)light, (uint8_t*)g_light,
+                sizeof(sodna_Color), num_columns, num_rows);
+        memcpy(fetched_light, light, num_columns * num_rows * sizeof(sodna_Color));
+        free(g_light); g_light = light;
+        free(g_fetched_light); g_fetched_light = fetched_light;
+    }
+
+    free_cells(g_cells);
+    g_cells = cells;
+    for (i = 1; i < g_num_layers; i++) {
+        if (!g_layers[i].cells)
+            continue;
+        free(g_layers[i].cells);
+        g_layers[i].cells = layers[i];
+    }
+    g_columns = num_columns;
+    g_rows = num_rows;
+    /* The queued commands were clipped to the old grid. */
+    g_num_commands = 0;
+    g_command_text_size = 0;
+
+    if (alloc_screen() != SODNA_OK || alloc_tracking() != SODNA_OK ||
+            (g_num_layers && alloc_compositing() != SODNA_OK))
+        return SODNA_ERROR;
+    update_terminal();
+
+    /* When following the window, the window already has the size we want. */
+    if (!g_auto_resize)
+        SDL_SetWindowSize(g_win, window_w(), window_h());
+
+    /* Don't process events here, they could resize the grid again. */
+    flush_changes();
+    return SODNA_OK;
+}
+
+/* Largest font scale at which the grid fits in a window of the given size. */
+static int fitting_font_scale(int w, int h) {
+    int w_scale = w / (g_columns * g_base_font_w);
+    int h_scale = h / (g_rows * g_base_font_h);
+    int scale = w_scale < h_scale ? w_scale : h_scale;
+    return scale > 0 ? scale : 1;
+}
+
+/* Resize the grid to fill a window of the given size. Return whether the
+ * grid size changed, which also repaints the screen. */
+static int fit_grid_to_window(int w, int h) {
+    int columns = w / g_font_w;
+    int rows = h / g_font_h;
+    int old_columns = g_columns, old_rows = g_rows;
+    sodna_resize(columns > 0 ? columns : 1, rows > 0 ? rows : 1);
+    return g_columns != old_columns || g_rows != old_rows;
+}
+
+void sodna_set_auto_resize(int is_auto_resize) {
+    g_auto_resize = is_auto_resize;
+    if (g_auto_resize && g_win) {
+        int w, h;
+        SDL_GetWindowSize(g_win, &w, &h);
+        fit_grid_to_window(w, h);
+    }
+}
+
+/* Update the screen after g_font was changed on a running terminal. */
+static sodna_Error apply_font_change(int old_w, int old_h) {
+    int is_repainted = 0;
+    /* Only the pixel buffers depend on the glyph size. */
+    if (g_font_w != old_w || g_font_h != old_h) {
+        if (alloc_screen() != SODNA_OK)
+            return SODNA_ERROR;
+        if (g_auto_resize) {
+            int w, h;
+            SDL_GetWindowSize(g_win, &w, &h);
+            is_repainted = fit_grid_to_window(w, h);
+        } else {
+            SDL_SetWindowSize(g_win, window_w(), window_h());
+        }
+    }
+
+    if (!is_repainted)
+        sodna_flush();
+    return SODNA_OK;
+}
+
+sodna_Error sodna_set_font_scale(int scale) {
+    int old_w = g_font_w, old_h = g_font_h;
+    if (scale < 0)
+        return SODNA_ERROR;
+    g_auto_font_scale = (scale == 0);
+    if (!g_win) {
+        /* Automatic scale starts from 1 since the window fits the grid. */
+        g_font_scale = scale > 0 ? scale : 1;
+        return SODNA_OK;
+    }
+
+    if (g_auto_font_scale) {
+        int w, h;
+        SDL_GetWindowSize(g_win, &w, &h);
+        scale = fitting_font_scale(w, h);
+    }
+    scale_font(scale);
+    if (g_auto_font_scale) {
+        /* Keep the window size, just fill more of it. */
+        if (g_font_w != old_w || g_font_h != old_h) {
+            if (alloc_screen() != SODNA_OK)
+                return SODNA_ERROR;
+        }
+        sodna_flush();
+        return SODNA_OK;
+    }
+    return apply_font_change(old_w, old_h);
+}
+
+sodna_Error sodna_set_font(const sodna_Font* font) {
+    int old_w = g_font_w, old_h = g_font_h;
+    if (!g_win)
+        return SODNA_ERROR;
+    if (init_font(font ? font : &default_font) != SODNA_OK)
+        return SODNA_ERROR;
+    return apply_font_change(old_w, old_h);
+}
+
+sodna_Error sodna_set_large_font(const sodna_Font* font, int num_glyphs) {
+    int old_w = g_font_w, old_h = g_font_h;
+    if (!g_win)
+        return SODNA_ERROR;
+    if (init_large_font(font, num_glyphs) != SODNA_OK)
+        return SODNA_ERROR;
+    return apply_font_change(old_w, old_h);
+}
+
+sodna_Error sodna_set_baked_font(const sodna_BakedFont* font) {
+    int old_w = g_font_w, old_h = g_font_h;
+    if (init_baked_font(font) != SODNA_OK)
+        return SODNA_ERROR;
+    return g_win ? apply_font_change(old_w, old_h) : SODNA_OK;
+}
+
+sodna_Error sodna_set_cell_format(sodna_CellFormat format) {
+    size_t size = cell_format_size(format);
+    if (!size)
+        return SODNA_UNSUPPORTED;
+    if (format == SODNA_CELLS_PALETTE)
+        init_palette();
+
+    if (g_win && format != g_cell_format) {
+        uint8_t* cells = alloc_cells(g_columns, g_rows, size);
+        if (!cells)
+            return SODNA_ERROR;
+        free_cells(g_cells);
+        g_cells = cells;
+        g_full_repaint = 1;
+    }
+    g_cell_format = format;
+    g_cell_size = size;
+    update_terminal();
+    return SODNA_OK;
+}
+
+/* Clip a cell rectangle to the grid. Return whether anything is left. */
+static int clip_rect(sodna_Rect* rect) {
+    if (rect->x < 0) { rect->w += rect->x; rect->x = 0; }
+    if (rect->y < 0) { rect->h += rect->y; rect->y = 0; }
+    if (rect->x + rect->w > g_columns) rect->w = g_columns - rect->x;
+    if (rect->y + rect->h > g_rows) rect->h = g_rows - rect->y;
+    return rect->w > 0 && rect->h > 0;
+}
+
+sodna_Cell* sodna_cells() {
+    return g_cell_format == SODNA_CELLS_RGB ? (sodna_Cell*)g_cells : NULL;
+}
+
+sodna_PaletteCell* sodna_palette_cells() {
+    return g_cell_format == SODNA_CELLS_PALETTE ? (sodna_PaletteCell*)g_cells : NULL;
+}
+
+sodna_CompactCell* sodna_compact_cells() {
+    return g_cell_format == SODNA_CELLS_COMPACT ? (sodna_CompactCell*)g_cells : NULL;
+}
+
+sodna_WideCell* sodna_wide_cells() {
+    return g_cell_format == SODNA_CELLS_WIDE ? (sodna_WideCell*)g_cells : NULL;
+}
+
+sodna_Error sodna_bind_cells(const sodna_CellLayout* layout) {
+    if (!layout) {
+        g_cells_are_bound = 0;
+        mark_all_rows_written();
+        return SODNA_OK;
+    }
+    if (!layout->fore.data || !layout->back.data || !layout->symbol.data ||
+            (layout->symbol_size != 1 && layout->symbol_size != 2) ||
+            layout->columns < 0 || layout->rows < 0)
+        return SODNA_ERROR;
+    g_bound_cells = *layout;
+    g_cells_are_bound = 1;
+    mark_all_rows_written();
+    return SODNA_OK;
+}
+
+void sodna_set_palette_entry(uint8_t index, sodna_Color color) {
+    init_palette();
+    /* Cells using the entry get redrawn since their keys change. */
+    g_palette[index] = rgb(color);
+    mark_all_rows_written();
+}
+
+sodna_Cell* sodna_layer_cells(int layer) {
+    Layer* l;
+    if (layer == 0)
+        return sodna_cells();
+    if (layer < 0 || layer >= SODNA_MAX_LAYERS || !g_cells)
+        return NULL;
+    l = &g_layers[layer];
+    if (l->cells)
+        return l->cells;
+
+    l->cells = (sodna_Cell*)calloc(g_columns * g_rows, sizeof(sodna_Cell));
+    if (!l->cells)
+        return NULL;
+    l->mode = SODNA_LAYER_NORMAL;
+    l->opacity = 0xff;
+    if (layer >= g_num_layers)
+        g_num_layers = layer + 1;
+    if (alloc_compositing() != SODNA_OK) {
+        sodna_remove_layer(layer);
+        return NULL;
+    }
+    return l->cells;
+}
+
+sodna_Error sodna_set_layer_mode(int layer, sodna_LayerMode mode, uint8_t opacity) {
+    if (layer < 1 || layer >= SODNA_MAX_LAYERS || !g_layers[layer].cells ||
+            mode < SODNA_LAYER_NORMAL || mode > SODNA_LAYER_ADD)
+        return SODNA_ERROR;
+    g_layers[layer].mode = mode;
+    g_layers[layer].opacity = opacity;
+    if (g_recompose_rows)
+        memset(g_recompose_rows, 1, g_rows);
+    return SODNA_OK;
+}
+
+void sodna_remove_layer(int layer) {
+    if (layer < 1 || layer >= SODNA_MAX_LAYERS || !g_layers[layer].cells)
+        return;
+    free_layer(&g_layers[layer]);
+    while (g_num_layers > 0 && !g_layers[g_num_layers - 1].cells)
+        g_num_layers--;
+    /* Layer 0 is the screen memory, so a count of 1 means no layers. */
+    if (g_num_layers <= 1)
+        free_layers();
+    else
+        memset(g_recompose_rows, 1, g_rows);
+    mark_all_rows_written();
+}
+
+sodna_Color* sodna_light_cells() {
+    size_t size = g_columns * g_rows * sizeof(sodna_Color);
+    if (g_light || !g_cells)
+        return g_light;
+    g_light = (sodna_Color*)malloc(size);
+    g_fetched_light = (sodna_Color*)malloc(size);
+    if (!g_light || !g_fetched_light) {
+        sodna_remove_light_cells();
+        return NULL;
+    }
+    memset(g_light, 0xff, size);
+    memset(g_fetched_light, 0xff, size);
+    return g_light;
+}
+
+void sodna_remove_light_cells() {
+    if (g_light)
+        mark_all_rows_written();
+    free(g_light); g_light = NULL;
+    free(g_fetched_light); g_fetched_light = NULL;
+}
+
+/* Have the rows under a shown overlay fetched again. */
+static void mark_overlay_rows(const Overlay* overlay) {
+    sodna_Rect area = overlay->rect;
+    if (overlay->style != SODNA_OVERLAY_HIDDEN && g_written_rows &&
+            clip_rect(&area))
+        memset(&g_written_rows[area.y], 1, area.h);
+}
+
+static void set_overlay(Overlay* overlay, const sodna_Rect* rect,
+        sodna_OverlayStyle style, sodna_Color color) {
+    int i;
+    /* Redraw both the cells the overlay leaves and the ones it covers. */
+    mark_overlay_rows(overlay);
+    overlay->rect = *rect;
+    overlay->style = style;
+    overlay->color = rgb(color);
+    mark_overlay_rows(overlay);
+
+    g_overlays_shown = 0;
+    for (i = 0; i <= SODNA_MAX_HIGHLIGHTS; i++)
+        g_overlays_shown |= g_overlays[i].style != SODNA_OVERLAY_HIDDEN;
+}
+
+void sodna_set_cursor(int x, int y, sodna_OverlayStyle style, sodna_Color color) {
+    sodna_Rect cell;
+    cell.x = x; cell.y = y; cell.w = 1; cell.h = 1;
+    set_overlay(&g_overlays[SODNA_MAX_HIGHLIGHTS], &cell, style, color);
+}
+
+sodna_Error sodna_set_highlight(int index, const sodna_Rect* rect,
+        sodna_OverlayStyle style, sodna_Color color) {
+    sodna_Rect none = { 0, 0, 0, 0 };
+    if (index < 0 || index >= SODNA_MAX_HIGHLIGHTS)
+        return SODNA_ERROR;
+    set_overlay(&g_overlays[index], rect ? rect : &none,
+            rect ? style : SODNA_OVERLAY_HIDDEN, color);
+    return SODNA_OK;
+}
+
+void sodna_set_edge_color(sodna_Color color) {
+    SDL_SetRenderDrawColor(g_rend, color.r, color.g, color.b, 255);
+}
+
+void sodna_set_global_tint(sodna_Color color, uint8_t alpha) {
+    g_tint_color = color;
+    g_tint_alpha = alpha;
+    apply_tint_mod();
+}
+
+sodna_Error sodna_set_fullscreen(int is_fullscreen_mode) {
+    int ret = SDL_SetWindowFullscreen(g_win,
+            (is_fullscreen_mode ? SDL_WINDOW_FULLSCREEN_DESKTOP : 0));
+    return (ret == 0 ? SODNA_OK : SODNA_ERROR);
+}
+
+/* Interpolate between the components of two colors. */
+static Uint32 blend(Uint32 fore_col, Uint32 back_col, uint8_t level) {
+    Uint32 ret;
+    uint8_t* back_comp = (uint8_t*)(&back_col);
+    uint8_t* fore_comp = (uint8_t*)(&fore_col);
+    uint8_t* target_comp = (uint8_t*)(&ret);
+    int i;
+    for (i = 0; i < 4; i++)
+        target_comp[i] = back_comp[i] + (fore_comp[i] - back_comp[i]) * level / 0xff;
+    return ret;
+}
+
+/* Look up the blended pixel values for the color pair of a cell key. */
+static const Uint32* blend_ramp(uint64_t colors, sodna_PixelFormat format) {
+    Blend_Ramp* ramp;
+    colors |= (uint64_t)format << 48;
+    ramp = &g_ramps[(colors * 0x9E3779B97F4A7C15ull) >> 56];
+    if (ramp->colors != colors) {
+        Uint32 fore = (colors >> 24) & 0xffffff;
+        Uint32 back = colors & 0xffffff;
+        int i;
+        for (i = 0; i < g_num_levels; i++)
+            ramp->ramp[g_levels[i]] =
+                pixel_color(blend(fore, back, g_levels[i]), format);
+        ramp->colors = colors;
+    }
+    return ramp->ramp;
+}
+
+/* Rasterize a cell into pixels with the given row pitch in bytes. */
+static void draw_glyph(uint8_t* dest, int pitch, uint64_t key, sodna_PixelFormat format) {
+    /* Loading the glyph's page can add coverage levels and reset the
+     * ramps, so the ramp must be looked up after it. */
+    const uint8_t* glyph = glyph_data(key & 0xffff);
+    const Uint32* ramp = blend_ramp(key >> 16, format);
+    int u, v;
+    if (pixel_format_size(format) == 2) {
+        for (v = 0; v < g_font_h; v++) {
+            Uint16* row = (Uint16*)dest;
+            for (u = 0; u < g_font_w; u++)
+                row[u] = (Uint16)ramp[glyph[u]];
+            glyph += g_font_w;
+            dest += pitch;
+        }
+        return;
+    }
+    for (v = 0; v < g_font_h; v++) {
+        Uint32* row = (Uint32*)dest;
+        for (u = 0; u < g_font_w; u++)
+            row[u] = ramp[glyph[u]];
+        glyph += g_font_w;
+        dest += pitch;
+    }
+}
+
+static int screen_pitch() {
+    return window_w() * g_pixel_size;
+}
+
+static void draw_cell(int x, int y, uint64_t key) {
+    draw_glyph(&g_pixels[y * screen_pitch() + x * g_pixel_size], screen_pitch(),
+            key, g_pixel_format);
+}
+
+/* Convert a row of cells in a caller-owned buffer into cell keys. */
+static void fetch_bound_row(int y, int x0, int x1, uint64_t* keys) {
+    const sodna_CellLayout* layout = &g_bound_cells;
+    const uint8_t* fore = (const uint8_t*)layout->fore.data
+        + y * layout->fore.row_stride + x0 * layout->fore.cell_stride;
+    const uint8_t* back = (const uint8_t*)layout->back.data
+        + y * layout->back.row_stride + x0 * layout->back.cell_stride;
+    const uint8_t* symbol = (const uint8_t*)layout->symbol.data
+        + y * layout->symbol.row_stride + x0 * layout->symbol.cell_stride;
+    int x = x0, columns = 0;
+    if (y < layout->rows)
+        columns = layout->columns < x1 ? layout->columns : x1;
+
+    for (; x < columns; x++) {
+        sodna_Color fore_col, back_col;
+        uint16_t wide_symbol;
+        memcpy(&fore_col, fore, sizeof(sodna_Color));
+        memcpy(&back_col, back, sizeof(sodna_Color));
+        if (layout->symbol_size == 2)
+            memcpy(&wide_symbol, symbol, 2);
+        else
+            wide_symbol = *symbol;
+        keys[x] = CELL_KEY(rgb(fore_col), rgb(back_col), wide_symbol);
+        fore += layout->fore.cell_stride;
+        back += layout->back.cell_stride;
+        symbol += layout->symbol.cell_stride;
+    }
+    for (; x < x1; x++)
+        keys[x] = 0;
+}
+
+/* Convert the screen memory cells in columns [x0, x1) of a row into cell
+ * keys. The keys are stored at their column index. */
+static void fetch_base_row(int y, int x0, int x1, uint64_t* keys) {
+    int x;
+    if (g_cells_are_bound) {
+        fetch_bound_row(y, x0, x1, keys);
+        return;
+    }
+    switch (g_cell_format) {
+        case SODNA_CELLS_RGB: {
+            const sodna_Cell* row = (const sodna_Cell*)g_cells + y * g_columns;
+            for (x = x0; x < x1; x++)
+                keys[x] = CELL_KEY(rgb(row[x].fore), rgb(row[x].back), row[x].symbol);
+            break;
+        }
+        case SODNA_CELLS_PALETTE: {
+            const sodna_PaletteCell* row = (const sodna_PaletteCell*)g_cells + y * g_columns;
+            for (x = x0; x < x1; x++)
+                keys[x] = CELL_KEY(g_palette[row[x].fore], g_palette[row[x].back], row[x].symbol);
+            break;
+        }
+        case SODNA_CELLS_COMPACT: {
+            const sodna_CompactCell* row = (const sodna_CompactCell*)g_cells + y * g_columns;
+            for (x = x0; x < x1; x++)
+                keys[x] = CELL_KEY(rgb12(row[x].fore), rgb12(row[x].back), row[x].symbol);
+            break;
+        }
+        case SODNA_CELLS_WIDE: {
+            const sodna_WideCell* row = (const sodna_WideCell*)g_cells + y * g_columns;
+            for (x = x0; x < x1; x++)
+                keys[x] = CELL_KEY(rgb(row[x].fore), rgb(row[x].back), row[x].symbol);
+            break;
+        }
+    }
+}
 
-    free(g_cells); g_cells = NULL;
-    g_cells = (sodna_Cell*)malloc(sodna_width() * sodna_height() * sizeof(sodna_Cell));
-    memset(g_cells, 0, sodna_width() * sodna_height() * sizeof(sodna_Cell));
+/* Multiply the components of two colors. */
+static uint32_t modulate(uint32_t a, uint32_t b) {
+    return ((a >> 16) * (b >> 16) / 0xff) << 16 |
+        ((a >> 8 & 0xff) * (b >> 8 & 0xff) / 0xff) << 8 |
+        (a & 0xff) * (b & 0xff) / 0xff;
+}
 
-    SDL_SetWindowSize(g_win, window_w(), window_h());
-    /* Simple aspect-retaining scaling, but not pixel-perfect. */
-    /* SDL_RenderSetLogicalSize(g_rend, window_w(), window_h()); */
+/* Add the components of two colors, saturating at full intensity. */
+static uint32_t add_colors(uint32_t a, uint32_t b) {
+    uint32_t r = (a >> 16) + (b >> 16);
+    uint32_t g = (a >> 8 & 0xff) + (b >> 8 & 0xff);
+    uint32_t bl = (a & 0xff) + (b & 0xff);
+    return (r > 0xff ? 0xff : r) << 16 | (g > 0xff ? 0xff : g) << 8 |
+        (bl > 0xff ? 0xff : bl);
+}
 
-    return SODNA_OK;
+/* Composite the layers over the screen memory cell key at a cell index. */
+static uint64_t composite_cell(uint64_t key, int index) {
+    uint32_t fore = (uint32_t)(key >> 40);
+    uint32_t back = (uint32_t)(key >> 16) & 0xffffff;
+    uint32_t symbol = (uint32_t)key & 0xffff;
+    int i, bottom;
+
+    /* Nothing under a solid cell of a normal layer shows through. */
+    for (bottom = g_num_layers - 1; bottom > 0; bottom--) {
+        const Layer* layer = &g_layers[bottom];
+        if (layer->cells && layer->mode == SODNA_LAYER_NORMAL &&
+                layer->opacity == 0xff && layer->cells[index].symbol)
+            break;
+    }
+    if (bottom == 0)
+        bottom = 1;
+
+    for (i = bottom; i < g_num_layers; i++) {
+        const Layer* layer = &g_layers[i];
+        sodna_Cell cell;
+        if (!layer->cells)
+            continue;
+        cell = layer->cells[index];
+        switch (layer->mode) {
+            case SODNA_LAYER_NORMAL:
+                if (!cell.symbol)
+                    break;
+                symbol = cell.symbol;
+                fore = blend(rgb(cell.fore), fore, layer->opacity);
+                back = blend(rgb(cell.back), back, layer->opacity);
+                break;
+            case SODNA_LAYER_GLYPH:
+                if (!cell.symbol)
+                    break;
+                symbol = cell.symbol;
+                fore = blend(rgb(cell.fore), fore, layer->opacity);
+                break;
+            case SODNA_LAYER_MULTIPLY:
+                fore = blend(modulate(fore, rgb(cell.fore)), fore, layer->opacity);
+                back = blend(modulate(back, rgb(cell.back)), back, layer->opacity);
+                break;
+            case SODNA_LAYER_ADD:
+                fore = blend(add_colors(fore, rgb(cell.fore)), fore, layer->opacity);
+                back = blend(add_colors(back, rgb(cell.back)), back, layer->opacity);
+                break;
+        }
+    }
+    return CELL_KEY(fore, back, symbol);
 }
 
-void sodna_exit() {
-    SDL_DestroyRenderer(g_rend); g_rend = NULL;
-    SDL_DestroyWindow(g_win); g_win = NULL;
-    SDL_DestroyTexture(g_texture); g_texture = NULL;
-    free(g_pixels); g_pixels = NULL;
-    free(g_cells); g_cells = NULL;
-    free(g_font); g_font = NULL;
-    SDL_Quit();
+/* Replace the screen memory keys of a row with the composited keys. Only
+ * the cells whose screen memory key changed get composited again, or the
+ * whole row if a layer changed on it.
+ */
+static void composite_row(int y, uint64_t* keys) {
+    uint64_t* base = &g_base_keys[y * g_columns];
+    uint64_t* composed = &g_composed[y * g_columns];
+    int i, x, layers_changed = g_recompose_rows[y];
+    for (i = 1; i < g_num_layers; i++) {
+        const Layer* layer = &g_layers[i];
+        const sodna_Cell* row;
+        sodna_Cell* composited;
+        if (!layer->cells)
+            continue;
+        row = &layer->cells[y * g_columns];
+        composited = &layer->composited[y * g_columns];
+        if (layers_changed || memcmp(row, composited, g_columns * sizeof(sodna_Cell))) {
+            memcpy(composited, row, g_columns * sizeof(sodna_Cell));
+            layers_changed = 1;
+        }
+    }
+    g_recompose_rows[y] = 0;
+
+    for (x = 0; x < g_columns; x++) {
+        if (layers_changed || keys[x] != base[x]) {
+            base[x] = keys[x];
+            composed[x] = composite_cell(keys[x], y * g_columns + x);
+        }
+        keys[x] = composed[x];
+    }
 }
 
-sodna_Cell* sodna_cells() {
-    return g_cells;
+/* Multiply the light into the colors of the keys of a row. */
+static void apply_light(int y, int x0, int x1, uint64_t* keys) {
+    const sodna_Color* light = &g_light[y * g_columns];
+    int x;
+    for (x = x0; x < x1; x++) {
+        uint32_t l = rgb(light[x]);
+        if (l == 0xffffff)
+            continue;
+        keys[x] = CELL_KEY(
+                modulate((uint32_t)(keys[x] >> 40), l),
+                modulate((uint32_t)(keys[x] >> 16) & 0xffffff, l),
+                keys[x] & 0xffff);
+    }
 }
 
-void sodna_set_edge_color(sodna_Color color) {
-    SDL_SetRenderDrawColor(g_rend, color.r, color.g, color.b, 255);
+static uint64_t overlay_key(uint64_t key, const Overlay* overlay) {
+    uint32_t fore = (uint32_t)(key >> 40), back = (uint32_t)(key >> 16) & 0xffffff;
+    if (overlay->style == SODNA_OVERLAY_INVERT)
+        return CELL_KEY(back, fore, key & 0xffff);
+    return CELL_KEY(fore, overlay->color, key & 0xffff);
 }
 
-sodna_Error sodna_set_fullscreen(int is_fullscreen_mode) {
-    int ret = SDL_SetWindowFullscreen(g_win,
-            (is_fullscreen_mode ? SDL_WINDOW_FULLSCREEN_DESKTOP : 0));
-    return (ret == 0 ? SODNA_OK : SODNA_ERROR);
+/* Apply the highlights and the cursor to the keys of a row. */
+static void apply_overlays(int y, int x0, int x1, uint64_t* keys) {
+    int i, x;
+    for (i = 0; i <= SODNA_MAX_HIGHLIGHTS; i++) {
+        const Overlay* overlay = &g_overlays[i];
+        int start = overlay->rect.x > x0 ? overlay->rect.x : x0;
+        int end = overlay->rect.x + overlay->rect.w < x1 ?
+            overlay->rect.x + overlay->rect.w : x1;
+        if (overlay->style == SODNA_OVERLAY_HIDDEN ||
+                y < overlay->rect.y || y >= overlay->rect.y + overlay->rect.h)
+            continue;
+        for (x = start; x < end; x++)
+            keys[x] = overlay_key(keys[x], overlay);
+    }
 }
 
-void draw_cell(int x, int y, Uint32 fore_col, Uint32 back_col, uint8_t symbol) {
-    int u, v;
-    for (v = 0; v < g_font_h; v++) {
-        size_t offset = x + (y + v) * window_w();
-        for (u = 0; u < g_font_w; u++) {
-            uint8_t col = g_font[font_offset(symbol, u, v)];
-            int i;
-            uint8_t* back_comp;
-            uint8_t* fore_comp;
-            uint8_t* target_comp;
-            switch (col) {
-                case 0:
-                    g_pixels[offset++] = back_col;
-                    break;
-                default:
-                    /* Interpolate between background and foreground. */
-                    back_comp = (uint8_t*)(&back_col);
-                    fore_comp = (uint8_t*)(&fore_col);
-                    target_comp = (uint8_t*)(&g_pixels[offset]);
-
-                    for (i = 0; i < 4; i++) {
-                        target_comp[i] = back_comp[i] + (fore_comp[i] - back_comp[i]) * col / 0xff;
-                    }
-                    ++offset;
-                    break;
-                case 255:
-                    g_pixels[offset++] = fore_col;
-                    break;
-            }
-        }
+/* Convert the cells in columns [x0, x1) of a row into cell keys with the
+ * layers composited in, the light applied and the overlays drawn. The keys
+ * are stored at their column index. */
+static void fetch_row(int y, int x0, int x1, uint64_t* keys) {
+    /* The compositing state is kept a whole row at a time. */
+    if (g_num_layers) {
+        fetch_base_row(y, 0, g_columns, keys);
+        composite_row(y, keys);
+    } else {
+        fetch_base_row(y, x0, x1, keys);
     }
+    if (g_light)
+        apply_light(y, x0, x1, keys);
+    if (g_overlays_shown)
+        apply_overlays(y, x0, x1, keys);
 }
 
 static void pixel_perfect_target_rect(
@@ -488,7 +2047,22 @@ static sodna_Event process_event(const SDL_Event* event) {
     memset(&ret, 0, sizeof(ret));
 
     if (event->type == SDL_WINDOWEVENT) {
-        sodna_flush();
+        if (event->window.event == SDL_WINDOWEVENT_SIZE_CHANGED && g_auto_resize) {
+            /* Resizing repaints the screen, no need for another flush. The
+             * event may be processed while sodna_flush() drains the queue,
+             * so the resize is reported by the next poll or wait. */
+            if (fit_grid_to_window(event->window.data1, event->window.data2))
+                g_resize_pending = 1;
+            return ret;
+        }
+        if (event->window.event == SDL_WINDOWEVENT_SIZE_CHANGED && g_auto_font_scale) {
+            int scale = fitting_font_scale(event->window.data1, event->window.data2);
+            if (scale != g_font_scale) {
+                scale_font(scale);
+                alloc_screen();
+            }
+        }
+        flush_changes();
         switch (event->window.event) {
             case SDL_WINDOWEVENT_ENTER:
             case SDL_WINDOWEVENT_FOCUS_GAINED:
@@ -581,31 +2155,791 @@ static sodna_Event process_event(const SDL_Event* event) {
     return ret;
 }
 
-void sodna_flush() {
-    int x, y;
-    SDL_Rect target;
+static void mark_rows_dirty(int first, int last) {
+    if (g_first_dirty_row < 0 || first < g_first_dirty_row)
+        g_first_dirty_row = first;
+    if (last > g_last_dirty_row)
+        g_last_dirty_row = last;
+}
+
+/* The i:th position of the span [start, start + count) when going outwards
+ * from the focus position. Goes in order if the focus is outside the span.
+ */
+static int in_focus_order(int start, int count, int focus, int i) {
+    int before = focus - start;
+    int after = start + count - 1 - focus;
+    int both_sides = before < after ? before : after;
+    if (before < 0 || after < 0)
+        return start + i;
+
+    /* Alternate between the sides while both have positions left. */
+    if (i <= 2 * both_sides)
+        return focus + (i % 2 ? (i + 1) / 2 : -i / 2);
+    i -= both_sides;
+    return focus + (after > before ? i : -i);
+}
+
+/* Add a command to the queue, return null if out of memory. */
+static Command* queue_command(Command_Type type, const sodna_Rect* rect) {
+    Command* ret;
+    if (g_num_commands == g_commands_capacity) {
+        int capacity = g_commands_capacity ? g_commands_capacity * 2 : 64;
+        Command* commands = (Command*)realloc(g_commands, capacity * sizeof(Command));
+        int* active;
+        if (!commands)
+            return NULL;
+        g_commands = commands;
+        active = (int*)realloc(g_active_commands, capacity * sizeof(int));
+        if (!active)
+            return NULL;
+        g_active_commands = active;
+        g_commands_capacity = capacity;
+    }
+    ret = &g_commands[g_num_commands++];
+    memset(ret, 0, sizeof(Command));
+    ret->type = type;
+    ret->rect = *rect;
+    return ret;
+}
+
+static int rect_contains(const sodna_Rect* outer, const sodna_Rect* inner) {
+    return inner->x >= outer->x && inner->y >= outer->y &&
+        inner->x + inner->w <= outer->x + outer->w &&
+        inner->y + inner->h <= outer->y + outer->h;
+}
+
+/* Merge a fill into the previous fill of the same cell if together they
+ * make up a rectangle. */
+static int merge_fill(const sodna_Rect* rect, sodna_Cell cell) {
+    Command* prev = g_num_commands ? &g_commands[g_num_commands - 1] : NULL;
+    sodna_Rect* r;
+    if (!prev || prev->type != COMMAND_FILL || memcmp(&prev->cell, &cell, sizeof(cell)))
+        return 0;
+    r = &prev->rect;
+    if (rect_contains(r, rect))
+        return 1;
+    if (r->x == rect->x && r->w == rect->w &&
+            rect->y <= r->y + r->h && r->y <= rect->y + rect->h) {
+        int bottom = r->y + r->h > rect->y + rect->h ? r->y + r->h : rect->y + rect->h;
+        r->y = r->y < rect->y ? r->y : rect->y;
+        r->h = bottom - r->y;
+        return 1;
+    }
+    if (r->y == rect->y && r->h == rect->h &&
+            rect->x <= r->x + r->w && r->x <= rect->x + rect->w) {
+        int right = r->x + r->w > rect->x + rect->w ? r->x + r->w : rect->x + rect->w;
+        r->x = r->x < rect->x ? r->x : rect->x;
+        r->w = right - r->x;
+        return 1;
+    }
+    return 0;
+}
+
+sodna_Error sodna_queue_fill(const sodna_Rect* rect, sodna_Cell cell) {
+    sodna_Rect area = *rect;
+    Command* command;
+    if (!g_cells)
+        return SODNA_ERROR;
+    if (!clip_rect(&area) || merge_fill(&area, cell))
+        return SODNA_OK;
+    command = queue_command(COMMAND_FILL, &area);
+    if (!command)
+        return SODNA_ERROR;
+    command->cell = cell;
+    return SODNA_OK;
+}
+
+sodna_Error sodna_queue_print(
+        int x, int y, const char* text, sodna_Color fore, sodna_Color back) {
+    sodna_Rect area;
+    Command* command;
+    size_t len = strlen(text);
+    if (!g_cells)
+        return SODNA_ERROR;
+    area.x = x; area.y = y; area.w = (int)len; area.h = 1;
+    if (!clip_rect(&area))
+        return SODNA_OK;
+
+    if (g_command_text_size + area.w > g_command_text_capacity) {
+        size_t capacity = g_command_text_capacity ? g_command_text_capacity : 1024;
+        char* buffer;
+        while (g_command_text_size + area.w > capacity)
+            capacity *= 2;
+        buffer = (char*)realloc(g_command_text, capacity);
+        if (!buffer)
+            return SODNA_ERROR;
+        g_command_text = buffer;
+        g_command_text_capacity = capacity;
+    }
+    command = queue_command(COMMAND_PRINT, &area);
+    if (!command)
+        return SODNA_ERROR;
+    command->cell.fore = fore;
+    command->cell.back = back;
+    command->text = g_command_text_size;
+    memcpy(&g_command_text[g_command_text_size], &text[area.x - x], area.w);
+    g_command_text_size += area.w;
+    return SODNA_OK;
+}
+
+sodna_Error sodna_queue_blit(
+        const sodna_Cell* cells, int pitch, const sodna_Rect* src_rect,
+        int dest_x, int dest_y) {
+    sodna_Rect area;
+    Command* command;
+    if (!g_cells)
+        return SODNA_ERROR;
+    area.x = dest_x; area.y = dest_y; area.w = src_rect->w; area.h = src_rect->h;
+    if (!clip_rect(&area))
+        return SODNA_OK;
+    command = queue_command(COMMAND_BLIT, &area);
+    if (!command)
+        return SODNA_ERROR;
+    command->src = &cells[(src_rect->y + area.y - dest_y) * pitch +
+        src_rect->x + area.x - dest_x];
+    command->src_pitch = pitch;
+    return SODNA_OK;
+}
+
+sodna_Error sodna_queue_recolor(
+        const sodna_Rect* rect, sodna_Color fore, sodna_Color back) {
+    sodna_Rect area = *rect;
+    Command* command;
+    if (!g_cells)
+        return SODNA_ERROR;
+    if (!clip_rect(&area))
+        return SODNA_OK;
+    command = queue_command(COMMAND_RECOLOR, &area);
+    if (!command)
+        return SODNA_ERROR;
+    command->cell.fore = fore;
+    command->cell.back = back;
+    return SODNA_OK;
+}
+
+sodna_Error sodna_queue_box(const sodna_Rect* rect, sodna_Color fore, sodna_Color back) {
+    sodna_Rect area = *rect;
+    Command* command;
+    if (!g_cells)
+        return SODNA_ERROR;
+    if (!clip_rect(&area))
+        return SODNA_OK;
+    command = queue_command(COMMAND_BOX, &area);
+    if (!command)
+        return SODNA_ERROR;
+    command->outline = *rect;
+    command->cell.fore = fore;
+    command->cell.back = back;
+    return SODNA_OK;
+}
+
+/* Draw the part of a command that is on row y. */
+static void run_command_row(const Command* command, sodna_Cell* row, int y) {
+    int x;
+    int x0 = command->rect.x, x1 = command->rect.x + command->rect.w;
+    sodna_Cell cell = command->cell;
+    switch (command->type) {
+        case COMMAND_FILL:
+            for (x = x0; x < x1; x++)
+                row[x] = cell;
+            break;
+        case COMMAND_PRINT:
+            for (x = x0; x < x1; x++) {
+                cell.symbol = (uint8_t)g_command_text[command->text + x - x0];
+                row[x] = cell;
+            }
+            break;
+        case COMMAND_BLIT:
+            memcpy(&row[x0], &command->src[(y - command->rect.y) * command->src_pitch],
+                    command->rect.w * sizeof(sodna_Cell));
+            break;
+        case COMMAND_RECOLOR:
+            for (x = x0; x < x1; x++) {
+                row[x].fore = cell.fore;
+                row[x].back = cell.back;
+            }
+            break;
+        case COMMAND_BOX: {
+            const sodna_Rect* box = &command->outline;
+            int left = box->x, right = box->x + box->w - 1;
+            int is_edge_row = y == box->y || y == box->y + box->h - 1;
+            for (x = x0; x < x1; x++) {
+                int is_corner_column = x == left || x == right;
+                if (!is_edge_row && !is_corner_column)
+                    continue;
+                if (is_edge_row && is_corner_column)
+                    cell.symbol = y == box->y ?
+                        (x == left ? 218 : 191) : (x == left ? 192 : 217);
+                else
+                    cell.symbol = is_edge_row ? 196 : 179;
+                row[x] = cell;
+            }
+            break;
+        }
+    }
+}
+
+/* How many later fills and blits a command is checked against for being
+ * drawn over completely. Culling is only a shortcut, so the check is kept
+ * short to keep running the queue linear. */
+#define CULL_CANDIDATES 16
+
+/* Mark a command culled if one of the last few later fills or blits among
+ * the commands active on its first row draws over it completely. */
+static void cull_command(Command* command, const int* later, int num_later) {
+    int i, checked = 0;
+    for (i = num_later - 1; i >= 0 && checked < CULL_CANDIDATES; i--) {
+        const Command* cover = &g_commands[later[i]];
+        if (cover->type != COMMAND_FILL && cover->type != COMMAND_BLIT)
+            continue;
+        if (rect_contains(&cover->rect, &command->rect)) {
+            command->is_culled = 1;
+            return;
+        }
+        checked++;
+    }
+}
+
+/* Run the queued commands a row at a time, so that each row of cells is
+ * visited once. The commands are bucketed by their first row, and each row
+ * only looks at the commands that cover it. */
+static void run_commands() {
+    int i, y, num_active = 0;
     sodna_Cell* cells = sodna_cells();
+    if (!g_num_commands)
+        return;
+    if (!cells) {
+        g_num_commands = 0;
+        g_command_text_size = 0;
+        return;
+    }
+
+    /* Build the buckets with the latest command first. */
+    for (y = 0; y < g_rows; y++)
+        g_command_rows[y] = -1;
+    for (i = 0; i < g_num_commands; i++) {
+        Command* command = &g_commands[i];
+        command->next = g_command_rows[command->rect.y];
+        g_command_rows[command->rect.y] = i;
+    }
+
+    for (y = 0; y < g_rows; y++) {
+        sodna_Cell* row = &cells[y * g_columns];
+        int kept = 0, num_new = 0, dest;
+
+        /* Drop the commands that ended or got culled. */
+        for (i = 0; i < num_active; i++) {
+            const Command* command = &g_commands[g_active_commands[i]];
+            if (!command->is_culled && y < command->rect.y + command->rect.h)
+                g_active_commands[kept++] = g_active_commands[i];
+        }
+        /* Merge in the commands starting here from the back, both lists
+         * are in queue order from the end. Everything placed after a new
+         * command is later in the queue than it. */
+        for (i = g_command_rows[y]; i >= 0; i = g_commands[i].next)
+            num_new++;
+        num_active = kept + num_new;
+        dest = num_active;
+        for (i = g_command_rows[y]; i >= 0; i = g_commands[i].next) {
+            while (kept && g_active_commands[kept - 1] > i)
+                g_active_commands[--dest] = g_active_commands[--kept];
+            g_active_commands[--dest] = i;
+            cull_command(&g_commands[i], &g_active_commands[dest + 1],
+                    num_active - dest - 1);
+        }
+
+        for (i = 0; i < num_active; i++) {
+            const Command* command = &g_commands[g_active_commands[i]];
+            if (command->is_culled)
+                continue;
+            run_command_row(command, row, y);
+            g_written_rows[y] = 1;
+        }
+    }
+    g_num_commands = 0;
+    g_command_text_size = 0;
+}
+
+/* Make every cell differ from g_drawn for a full repaint. Cells get drawn
+ * and recorded one at a time, so a repaint cut short by the flush budget
+ * keeps its progress. */
+static void forget_drawn_cells() {
+    int i;
+    for (i = 0; i < g_columns * g_rows; i++)
+        g_drawn[i] = NEVER_DRAWN;
+    mark_all_rows_written();
+}
+
+/* Rasterize the cells in the area that changed since they were last drawn.
+ * Stops early and returns 0 when it runs out of the cell budget or goes past
+ * the deadline performance counter, 0 for either means no limit. The cells
+ * left over still differ from g_drawn, so the next call picks them up.
+ */
+static int rasterize_changes(const sodna_Rect* area, int max_cells, Uint64 deadline) {
+    int i, j, x, y, num_drawn = 0;
+    int whole_rows = area->x == 0 && area->w == g_columns;
+    for (i = 0; i < area->h; i++) {
+        uint64_t* drawn;
+        int row_changed = 0;
+        y = in_focus_order(area->y, area->h, g_flush_focus_y, i);
+        if (!row_was_written(y))
+            continue;
+        drawn = &g_drawn[y * g_columns];
+        fetch_row(y, area->x, area->x + area->w, g_row_keys);
+        for (j = 0; j < area->w; j++) {
+            x = in_focus_order(area->x, area->w, g_flush_focus_x, j);
+            if (g_row_keys[x] != drawn[x] || g_row_keys[x] == NEVER_DRAWN) {
+                /* The clock is only checked once per changed row. */
+                if ((max_cells && num_drawn == max_cells) ||
+                        (deadline && num_drawn && !row_changed &&
+                         SDL_GetPerformanceCounter() >= deadline)) {
+                    if (row_changed)
+                        mark_rows_dirty(y, y);
+                    return 0;
+                }
+                drawn[x] = g_row_keys[x];
+                draw_cell(x * g_font_w, y * g_font_h, drawn[x]);
+                row_changed = 1;
+                num_drawn++;
+            }
+        }
+        if (row_changed)
+            mark_rows_dirty(y, y);
+        if (whole_rows && g_written_rows[y]) {
+            /* Keep the write in mind for the snapshots. */
+            if (g_snapshots)
+                memset(&g_written_tiles[y / TILE_H * tiles_across()], 1, tiles_across());
+            g_written_rows[y] = 0;
+        }
+    }
+    return 1;
+}
+
+/* Add the tint color scaled by the tint alpha over the target. Tinting to
+ * black needs no fill, the texture color mod already does all of it.
+ */
+static void draw_tint(const SDL_Rect* target) {
+    Uint8 r, g, b, a;
+    int alpha = g_tint_alpha;
+    if (!(g_tint_color.r | g_tint_color.g | g_tint_color.b))
+        return;
+    /* The draw color doubles as the edge color, keep it intact. */
+    SDL_GetRenderDrawColor(g_rend, &r, &g, &b, &a);
+    SDL_SetRenderDrawBlendMode(g_rend, SDL_BLENDMODE_ADD);
+    SDL_SetRenderDrawColor(g_rend,
+            g_tint_color.r * alpha / 255,
+            g_tint_color.g * alpha / 255,
+            g_tint_color.b * alpha / 255, 255);
+    SDL_RenderFillRect(g_rend, target);
+    SDL_SetRenderDrawBlendMode(g_rend, SDL_BLENDMODE_NONE);
+    SDL_SetRenderDrawColor(g_rend, r, g, b, a);
+}
+
+/* Send a rectangle of g_pixels to the texture, through the post-process
+ * effect if there is one. The effect works on a copy so that the pixels it
+ * gets are never already processed.
+ */
+static void upload_pixels(const SDL_Rect* rect) {
+    int offset = rect->y * screen_pitch() + rect->x * g_pixel_size;
+    const uint8_t* pixels = g_pixels;
+    if (g_post_process) {
+        sodna_Rect area;
+        int y;
+        for (y = 0; y < rect->h; y++) {
+            memcpy(&g_post_pixels[offset + y * screen_pitch()],
+                    &g_pixels[offset + y * screen_pitch()],
+                    rect->w * g_pixel_size);
+        }
+        area.x = rect->x; area.y = rect->y; area.w = rect->w; area.h = rect->h;
+        g_post_process(g_post_data, g_post_pixels, screen_pitch(),
+                g_pixel_format, &area, window_w(), window_h());
+        pixels = g_post_pixels;
+    }
+    SDL_UpdateTexture(g_texture, rect, &pixels[offset], screen_pitch());
+}
+
+static void present() {
+    SDL_Rect target;
+    SDL_RenderClear(g_rend);
+    pixel_perfect_target_rect(&target, window_w(), window_h(), g_rend);
+    SDL_RenderCopy(g_rend, g_texture, NULL, &target);
+    if (g_tint_alpha)
+        draw_tint(&target);
+    SDL_RenderPresent(g_rend);
+}
+
+/* Rasterize, upload and present the changes without processing events. */
+static void flush_changes() {
+    sodna_Rect all;
+    Uint64 deadline = 0;
+    run_commands();
+    if (g_full_repaint) {
+        forget_drawn_cells();
+        g_full_repaint = 0;
+    }
+    collect_written_rows();
+    if (g_flush_max_us)
+        deadline = SDL_GetPerformanceCounter() +
+            (Uint64)g_flush_max_us * SDL_GetPerformanceFrequency() / 1000000;
+    all.x = 0; all.y = 0; all.w = g_columns; all.h = g_rows;
+    g_frame_complete = rasterize_changes(&all, g_flush_max_cells, deadline);
+
+    /* Upload the span of rows that changed. */
+    if (g_first_dirty_row >= 0) {
+        SDL_Rect rows;
+        rows.x = 0;
+        rows.y = g_first_dirty_row * g_font_h;
+        rows.w = window_w();
+        rows.h = (g_last_dirty_row - g_first_dirty_row + 1) * g_font_h;
+        upload_pixels(&rows);
+        g_first_dirty_row = g_last_dirty_row = -1;
+    }
+
+    present();
+}
+
+void sodna_flush() {
     /* Flush the events the user didn't look into, there might be resize events. */
     SDL_Event event;
     while (SDL_PollEvent(&event)) { process_event(&event); }
+    flush_changes();
+}
+
+void sodna_flush_rect(int x, int y, int w, int h) {
+    sodna_Rect area;
+    SDL_Rect pixels;
+    int first_dirty = g_first_dirty_row, last_dirty = g_last_dirty_row;
+
+    /* A pending full repaint can't be split up, do the whole thing. */
+    if (g_full_repaint) {
+        sodna_flush();
+        return;
+    }
+    area.x = x; area.y = y; area.w = w; area.h = h;
+    if (!clip_rect(&area))
+        return;
+
+    collect_written_rows();
+    /* Only the pixels of the rectangle get uploaded. Rows that were already
+     * pending stay pending for the next full flush. */
+    g_first_dirty_row = g_last_dirty_row = -1;
+    rasterize_changes(&area, 0, 0);
+    if (g_first_dirty_row >= 0) {
+        pixels.x = area.x * g_font_w;
+        pixels.y = g_first_dirty_row * g_font_h;
+        pixels.w = area.w * g_font_w;
+        pixels.h = (g_last_dirty_row - g_first_dirty_row + 1) * g_font_h;
+        upload_pixels(&pixels);
+    }
+    g_first_dirty_row = first_dirty;
+    g_last_dirty_row = last_dirty;
+
+    present();
+}
+
+const sodna_Terminal* sodna_terminal() {
+    return &g_terminal;
+}
+
+void sodna_use_dirty_rows(int use_dirty_rows) {
+    g_use_dirty_rows = use_dirty_rows;
+    mark_all_rows_written();
+}
+
+void sodna_set_flush_budget(int max_cells, int max_us) {
+    g_flush_max_cells = max_cells > 0 ? max_cells : 0;
+    g_flush_max_us = max_us > 0 ? max_us : 0;
+}
 
-    /* XXX: Always repaints all cells, even if there was no change from
-     * previous frame. Could use a twin cell buffer and check for change
-     * from previous frame to see if we can skip draw_cell.
+void sodna_set_flush_focus(int x, int y) {
+    g_flush_focus_x = x;
+    g_flush_focus_y = y;
+}
+
+int sodna_frame_complete() {
+    return g_frame_complete;
+}
+
+sodna_Error sodna_set_post_process(sodna_PostProcess effect, void* data) {
+    if (effect && g_pixels && !g_post_pixels) {
+        g_post_pixels = (uint8_t*)malloc(window_w() * window_h() * g_pixel_size);
+        if (!g_post_pixels)
+            return SODNA_ERROR;
+    }
+    if (!effect) {
+        free(g_post_pixels); g_post_pixels = NULL;
+    }
+    g_post_process = effect;
+    g_post_data = data;
+    /* Upload everything again with or without the effect, the pixels
+     * themselves don't need to change. */
+    if (g_pixels)
+        mark_rows_dirty(0, g_rows - 1);
+    return SODNA_OK;
+}
+
+/* Move a run of cells along with their rasterized pixels. */
+static void move_cells(int src_x, int src_y, int dest_x, int dest_y, int count) {
+    int v;
+    memmove(&g_cells[(dest_y * g_columns + dest_x) * g_cell_size],
+            &g_cells[(src_y * g_columns + src_x) * g_cell_size],
+            count * g_cell_size);
+
+    /* The pixels are only worth moving if they are up to date with
+     * g_drawn, otherwise everything gets redrawn anyway.
      */
-    for (y = 0; y < sodna_height(); y++)
-        for (x = 0; x < sodna_width(); x++) {
-            sodna_Cell cell = cells[x + sodna_width() * y];
-            Uint32 fore = convert_color(cell.fore);
-            Uint32 back = convert_color(cell.back);
-            draw_cell(x * g_font_w, y * g_font_h, fore, back, cell.symbol);
+    if (g_full_repaint)
+        return;
+    memmove(&g_drawn[dest_y * g_columns + dest_x],
+            &g_drawn[src_y * g_columns + src_x],
+            count * sizeof(uint64_t));
+    for (v = 0; v < g_font_h; v++) {
+        memmove(&g_pixels[(dest_y * g_font_h + v) * screen_pitch() +
+                    dest_x * g_font_w * g_pixel_size],
+                &g_pixels[(src_y * g_font_h + v) * screen_pitch() +
+                    src_x * g_font_w * g_pixel_size],
+                count * g_font_w * g_pixel_size);
+    }
+    mark_rows_dirty(dest_y, dest_y);
+}
+
+sodna_Error sodna_scroll(const sodna_Rect* rect, int dx, int dy, const void* fill_cell) {
+    sodna_Rect area, moved;
+    int x, y;
+    if (!g_cells)
+        return SODNA_ERROR;
+    /* Can't move the cells around in a caller-owned buffer. */
+    if (g_cells_are_bound)
+        return SODNA_UNSUPPORTED;
+
+    area.x = 0; area.y = 0; area.w = g_columns; area.h = g_rows;
+    if (rect)
+        area = *rect;
+    if (!clip_rect(&area))
+        return SODNA_OK;
+
+    moved.x = area.x + (dx > 0 ? dx : 0);
+    moved.y = area.y + (dy > 0 ? dy : 0);
+    moved.w = area.w - abs(dx);
+    moved.h = area.h - abs(dy);
+    if (moved.w > 0 && moved.h > 0) {
+        for (y = 0; y < moved.h; y++) {
+            /* Go against the direction of movement so that rows are moved
+             * before they get overwritten.
+             */
+            int row = dy > 0 ? moved.h - 1 - y : y;
+            move_cells(moved.x - dx, moved.y + row - dy,
+                    moved.x, moved.y + row, moved.w);
         }
-    SDL_RenderClear(g_rend);
-    SDL_UpdateTexture(g_texture, NULL, g_pixels, window_w() * sizeof(Uint32));
+    } else {
+        moved.w = moved.h = 0;
+    }
 
-    pixel_perfect_target_rect(&target, window_w(), window_h(), g_rend);
-    SDL_RenderCopy(g_rend, g_texture, NULL, &target);
-    SDL_RenderPresent(g_rend);
+    /* Only the exposed cells will need to be rasterized. */
+    for (y = area.y; y < area.y + area.h; y++) {
+        for (x = area.x; x < area.x + area.w; x++) {
+            uint8_t* cell = &g_cells[(y * g_columns + x) * g_cell_size];
+            if (x >= moved.x && x < moved.x + moved.w &&
+                    y >= moved.y && y < moved.y + moved.h)
+                continue;
+            if (fill_cell)
+                memcpy(cell, fill_cell, g_cell_size);
+            else
+                memset(cell, 0, g_cell_size);
+        }
+    }
+    memset(&g_written_rows[area.y], 1, area.h);
+    return SODNA_OK;
+}
+
+/* Clip the tile at (tx, ty) to the grid, return the offset of its first cell. */
+static size_t tile_span(int tx, int ty, int* out_w, int* out_h) {
+    int x = tx * TILE_W, y = ty * TILE_H;
+    *out_w = g_columns - x < TILE_W ? g_columns - x : TILE_W;
+    *out_h = g_rows - y < TILE_H ? g_rows - y : TILE_H;
+    return (size_t)(y * g_columns + x) * g_cell_size;
+}
+
+/* Whether the tile at (tx, ty) may have been written since the latest push,
+ * as far as the tracked writes tell. */
+static int tile_was_written(int tx, int ty) {
+    int v, w, h;
+    tile_span(tx, ty, &w, &h);
+    if (g_written_tiles[ty * tiles_across() + tx])
+        return 1;
+    for (v = 0; v < h; v++)
+        if (g_written_rows[ty * TILE_H + v])
+            return 1;
+    return 0;
+}
+
+static int tile_matches_screen(const Tile* tile, int tx, int ty) {
+    int v, w, h;
+    const uint8_t* cells = &g_cells[tile_span(tx, ty, &w, &h)];
+    for (v = 0; v < h; v++)
+        if (memcmp(&cells[v * g_columns * g_cell_size],
+                    &tile->cells[v * TILE_W * g_cell_size], w * g_cell_size))
+            return 0;
+    return 1;
+}
+
+/* Whether the screen memory of the tile at (tx, ty) may differ from the
+ * tile saved by the latest push. Checks the tracked writes when there are
+ * any and compares the cells otherwise. */
+static int tile_changed(const Tile* tile, int tx, int ty, int is_tracked) {
+    return is_tracked ? tile_was_written(tx, ty) : !tile_matches_screen(tile, tx, ty);
+}
+
+/* Copy the cells of the tile at (tx, ty) from the screen memory to the
+ * tile, or back to the screen memory if restore is set. */
+static void copy_tile(Tile* tile, int tx, int ty, int restore) {
+    int v, w, h;
+    uint8_t* cells = &g_cells[tile_span(tx, ty, &w, &h)];
+    for (v = 0; v < h; v++) {
+        uint8_t* screen_row = &cells[v * g_columns * g_cell_size];
+        uint8_t* tile_row = &tile->cells[v * TILE_W * g_cell_size];
+        if (restore) {
+            memcpy(screen_row, tile_row, w * g_cell_size);
+            g_written_rows[ty * TILE_H + v] = 1;
+        } else {
+            memcpy(tile_row, screen_row, w * g_cell_size);
+        }
+    }
+}
+
+static int snapshot_fits_screen(const Snapshot* snapshot) {
+    return snapshot->columns == g_columns && snapshot->rows == g_rows &&
+        snapshot->format == g_cell_format;
+}
+
+sodna_Error sodna_push_screen() {
+    int tx, ty, is_tracked;
+    int tiles_x = (g_columns + TILE_W - 1) / TILE_W;
+    int tiles_y = (g_rows + TILE_H - 1) / TILE_H;
+    const Snapshot* prev = g_snapshots;
+    Snapshot* snapshot;
+    if (!g_cells)
+        return SODNA_ERROR;
+    if (prev && !snapshot_fits_screen(prev))
+        prev = NULL;
+    collect_written_rows();
+    is_tracked = rows_are_tracked();
+
+    snapshot = (Snapshot*)calloc(1, sizeof(Snapshot));
+    if (!snapshot)
+        return SODNA_ERROR;
+    snapshot->columns = g_columns;
+    snapshot->rows = g_rows;
+    snapshot->format = g_cell_format;
+    snapshot->tiles = (Tile**)calloc(tiles_x * tiles_y, sizeof(Tile*));
+    if (!snapshot->tiles) {
+        free_snapshot(snapshot);
+        return SODNA_ERROR;
+    }
+
+    for (ty = 0; ty < tiles_y; ty++) {
+        for (tx = 0; tx < tiles_x; tx++) {
+            int i = ty * tiles_x + tx;
+            Tile* tile;
+            if (prev && !tile_changed(prev->tiles[i], tx, ty, is_tracked)) {
+                snapshot->tiles[i] = prev->tiles[i];
+                snapshot->tiles[i]->refs++;
+                continue;
+            }
+            tile = (Tile*)malloc(sizeof(Tile) + TILE_W * TILE_H * g_cell_size);
+            if (!tile) {
+                free_snapshot(snapshot);
+                return SODNA_ERROR;
+            }
+            tile->refs = 1;
+            copy_tile(tile, tx, ty, 0);
+            snapshot->tiles[i] = tile;
+        }
+    }
+
+    snapshot->prev = g_snapshots;
+    g_snapshots = snapshot;
+    memset(g_written_tiles, 0, num_tiles());
+    return SODNA_OK;
+}
+
+sodna_Error sodna_pop_screen() {
+    int tx, ty, is_tracked;
+    int tiles_x = (g_columns + TILE_W - 1) / TILE_W;
+    int tiles_y = (g_rows + TILE_H - 1) / TILE_H;
+    Snapshot* snapshot = g_snapshots;
+    sodna_Error ret = SODNA_ERROR;
+    if (!snapshot)
+        return SODNA_ERROR;
+    g_snapshots = snapshot->prev;
+
+    if (g_cells && snapshot_fits_screen(snapshot)) {
+        const Snapshot* prev = g_snapshots;
+        collect_written_rows();
+        is_tracked = rows_are_tracked();
+        if (prev && !snapshot_fits_screen(prev))
+            prev = NULL;
+        for (ty = 0; ty < tiles_y; ty++) {
+            for (tx = 0; tx < tiles_x; tx++) {
+                int i = ty * tiles_x + tx;
+                Tile* tile = snapshot->tiles[i];
+                if (tile_changed(tile, tx, ty, is_tracked))
+                    copy_tile(tile, tx, ty, 1);
+                /* The screen now holds this snapshot, which matches the one
+                 * below it where the two share tiles. */
+                g_written_tiles[i] = !prev || prev->tiles[i] != tile;
+            }
+        }
+        ret = SODNA_OK;
+    }
+    free_snapshot(snapshot);
+    return ret;
+}
+
+sodna_Error sodna_render_to(
+        void* pixels, int pitch, sodna_PixelFormat format, const sodna_Rect* rect) {
+    int x, y, size = pixel_format_size(format);
+    sodna_Rect area, origin;
+    if (!g_cells || !size)
+        return SODNA_ERROR;
+
+    area.x = 0; area.y = 0; area.w = g_columns; area.h = g_rows;
+    if (rect)
+        area = *rect;
+    /* The pixels stay where the unclipped rectangle puts them. */
+    origin = area;
+    if (!clip_rect(&area))
+        return SODNA_OK;
+
+    for (y = area.y; y < area.y + area.h; y++) {
+        uint8_t* dest = (uint8_t*)pixels + (size_t)(y - origin.y) * g_font_h * pitch;
+        fetch_row(y, area.x, area.x + area.w, g_row_keys);
+        for (x = area.x; x < area.x + area.w; x++)
+            draw_glyph(dest + (size_t)(x - origin.x) * g_font_w * size, pitch,
+                    g_row_keys[x], format);
+    }
+    return SODNA_OK;
+}
+
+sodna_PixelFormat sodna_pixel_format() {
+    return g_pixel_format;
+}
+
+void sodna_char_size(int* out_width, int* out_height) {
+    if (out_width)
+        *out_width = g_font_w;
+    if (out_height)
+        *out_height = g_font_h;
+}
+
+/* Take the resize left for the next poll or wait, if there is one. */
+static int take_pending_resize(sodna_Event* out_event) {
+    if (!g_resize_pending)
+        return 0;
+    g_resize_pending = 0;
+    memset(out_event, 0, sizeof(sodna_Event));
+    out_event->type = SODNA_EVENT_RESIZED;
+    return 1;
 }
 
 sodna_Event sodna_wait_event(int timeout_ms) {
@@ -614,6 +2948,8 @@ sodna_Event sodna_wait_event(int timeout_ms) {
     for (;;) {
         int status;
         sodna_Event ret;
+        if (take_pending_resize(&ret))
+            return ret;
         memset(&ret, 0, sizeof(ret));
 
         if (timeout_ms <= 0)
@@ -631,13 +2967,16 @@ sodna_Event sodna_wait_event(int timeout_ms) {
 
 sodna_Event sodna_poll_event() {
     static sodna_Event empty;
+    sodna_Event ret;
 
     SDL_Event event;
-    while (SDL_PollEvent(&event)) {
-        sodna_Event ret = process_event(&event);
+    while (!g_resize_pending && SDL_PollEvent(&event)) {
+        ret = process_event(&event);
         if (ret.type)
             return ret;
     }
+    if (take_pending_resize(&ret))
+        return ret;
     return empty;
 }
 
@@ -660,9 +2999,10 @@ size_t sodna_dump_screenshot(uint8_t* out_pixels, int* out_width, int* out_heigh
         int i;
         for (i = 0; i < pixels; i++) {
             Uint8 r, g, b;
-            r = g_pixels[i] >> 16;
-            g = g_pixels[i] >> 8;
-            b = g_pixels[i];
+            uint32_t color = pixel_rgb(&g_pixels[i * g_pixel_size], g_pixel_format);
+            r = color >> 16;
+            g = color >> 8;
+            b = color;
             out_pixels[i*3 + 0] = r;
             out_pixels[i*3 + 1] = g;
             out_pixels[i*3 + 2] = b;
@@ -4,11 +4,23 @@
  */
 
 #include "sodna.h"
+#include "sodna_util.h"
 #include "stb_image.h"
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
 #include <stdint.h>
 #include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 int sodna_save_screenshot_png(const char* path) {
     int ret;
@@ -21,8 +33,16 @@ int sodna_save_screenshot_png(const char* path) {
 }
 
 int sodna_load_font(char* path, sodna_Font** out_font) {
-    int w, h, n, font_w, font_h, i;
-    uint8_t* data = stbi_load(path, &w, &h, &n, 1);
+    return sodna_load_font_sheet(path, 256, out_font);
+}
+
+int sodna_load_font_sheet(char* path, int num_glyphs, sodna_Font** out_font) {
+    int w, h, n, i;
+    int rows = (num_glyphs + 15) / 16;
+    uint8_t* data;
+    if (num_glyphs < 256 || num_glyphs > 0x10000)
+        return SODNA_ERROR;
+    data = stbi_load(path, &w, &h, &n, 1);
     if (!data) return SODNA_ERROR;
 
     *out_font = (sodna_Font*)malloc(sizeof(sodna_Font) + w * h);
@@ -31,8 +51,449 @@ int sodna_load_font(char* path, sodna_Font** out_font) {
     stbi_image_free(data);
 
     (*out_font)->char_width = w / 16;
-    (*out_font)->char_height = h / 16;
+    (*out_font)->char_height = h / rows;
     (*out_font)->pitch = w;
 
     return SODNA_OK;
 }
+
+static uint32_t baked_num_glyphs(const sodna_BakedFont* font) {
+    const uint8_t* n = (const uint8_t*)&font->num_glyphs;
+    return n[0] | n[1] << 8 | n[2] << 16 | (uint32_t)n[3] << 24;
+}
+
+static size_t baked_font_size(const sodna_BakedFont* font) {
+    return sizeof(sodna_BakedFont) +
+        (size_t)baked_num_glyphs(font) * font->char_width * font->char_height;
+}
+
+int sodna_save_baked_font(const sodna_Font* font, int num_glyphs, const char* path) {
+    int c, y, columns;
+    uint8_t header[sizeof(sodna_BakedFont)];
+    FILE* file;
+    if (!font->char_width || !font->char_height || num_glyphs < 256 ||
+            font->pitch < font->char_width)
+        return SODNA_ERROR;
+    columns = font->pitch / font->char_width;
+
+    memcpy(header, SODNA_BAKED_FONT_MAGIC, 4);
+    header[4] = SODNA_BAKED_FONT_VERSION;
+    header[5] = font->char_width;
+    header[6] = font->char_height;
+    header[7] = 0;
+    header[8] = num_glyphs;
+    header[9] = num_glyphs >> 8;
+    header[10] = num_glyphs >> 16;
+    header[11] = num_glyphs >> 24;
+
+    file = fopen(path, "wb");
+    if (!file)
+        return SODNA_ERROR;
+    fwrite(header, sizeof(header), 1, file);
+    for (c = 0; c < num_glyphs; c++) {
+        size_t origin = (size_t)(c / columns) * font->char_height * font->pitch +
+            (c % columns) * font->char_width;
+        for (y = 0; y < font->char_height; y++)
+            fwrite(&font->pixel_data[origin + y * font->pitch],
+                    font->char_width, 1, file);
+    }
+    return fclose(file) == 0 ? SODNA_OK : SODNA_ERROR;
+}
+
+static void unmap_file(const void* data, size_t size) {
+#ifdef _WIN32
+    UnmapViewOfFile(data);
+#else
+    munmap((void*)data, size);
+#endif
+}
+
+int sodna_map_baked_font(const char* path, const sodna_BakedFont** out_font) {
+    const sodna_BakedFont* font;
+    size_t size;
+    void* data;
+#ifdef _WIN32
+    HANDLE mapping;
+    LARGE_INTEGER file_size;
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return SODNA_ERROR;
+    if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart < sizeof(sodna_BakedFont)) {
+        CloseHandle(file);
+        return SODNA_ERROR;
+    }
+    size = (size_t)file_size.QuadPart;
+    mapping = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(file);
+    if (!mapping)
+        return SODNA_ERROR;
+    data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+    if (!data)
+        return SODNA_ERROR;
+#else
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return SODNA_ERROR;
+    if (fstat(fd, &st) != 0 || st.st_size < sizeof(sodna_BakedFont)) {
+        close(fd);
+        return SODNA_ERROR;
+    }
+    size = st.st_size;
+    /* A shared mapping lets processes using the same font share the pages. */
+    data = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return SODNA_ERROR;
+#endif
+
+    font = (const sodna_BakedFont*)data;
+    if (memcmp(font->magic, SODNA_BAKED_FONT_MAGIC, 4) != 0 ||
+            font->version != SODNA_BAKED_FONT_VERSION ||
+            baked_font_size(font) > size) {
+        unmap_file(data, size);
+        return SODNA_ERROR;
+    }
+#ifndef _WIN32
+    /* Drop the pages past the end of the font data, so that unmapping
+     * baked_font_size() bytes releases the whole mapping. */
+    {
+        size_t page = (size_t)sysconf(_SC_PAGESIZE);
+        size_t used = (baked_font_size(font) + page - 1) / page * page;
+        if (used < size)
+            munmap((uint8_t*)data + used, size - used);
+    }
+#endif
+
+    *out_font = font;
+    return SODNA_OK;
+}
+
+void sodna_unmap_baked_font(const sodna_BakedFont* font) {
+    if (font)
+        unmap_file(font, baked_font_size(font));
+}
+
+sodna_Canvas* sodna_new_canvas(int width, int height) {
+    sodna_Canvas* canvas;
+    if (width < 1 || height < 1)
+        return NULL;
+    canvas = (sodna_Canvas*)calloc(
+            1, sizeof(sodna_Canvas) + (size_t)width * height * sizeof(sodna_Cell));
+    if (!canvas)
+        return NULL;
+    canvas->width = width;
+    canvas->height = height;
+    canvas->pitch = width;
+    canvas->cells = (sodna_Cell*)(canvas + 1);
+    return canvas;
+}
+
+sodna_Canvas sodna_screen_canvas() {
+    sodna_Canvas ret;
+    ret.cells = sodna_cells();
+    ret.width = ret.cells ? sodna_width() : 0;
+    ret.height = ret.cells ? sodna_height() : 0;
+    ret.pitch = ret.width;
+    return ret;
+}
+
+/* Keyed blits treat cells as 64-bit words. */
+typedef char cell_is_64_bits[sizeof(sodna_Cell) == 8 ? 1 : -1];
+
+typedef struct {
+    uint64_t symbol_mask;
+    uint64_t symbol;
+    uint64_t back_mask;
+    uint64_t back;
+} Blit_Key;
+
+static uint64_t cell_bits(sodna_Cell cell) {
+    uint64_t ret;
+    memcpy(&ret, &cell, sizeof(ret));
+    return ret;
+}
+
+/* Disabled keys get a mask of zero and a value that can't match it. */
+static Blit_Key blit_key(int flags, sodna_Cell key) {
+    Blit_Key ret;
+    sodna_Cell mask;
+    memset(&mask, 0, sizeof(mask));
+    mask.symbol = 0xff;
+    ret.symbol_mask = flags & SODNA_BLIT_SYMBOL_KEY ? cell_bits(mask) : 0;
+    ret.symbol = flags & SODNA_BLIT_SYMBOL_KEY ? cell_bits(key) & ret.symbol_mask : ~(uint64_t)0;
+
+    memset(&mask, 0, sizeof(mask));
+    mask.back.r = mask.back.g = mask.back.b = 0xff;
+    ret.back_mask = flags & SODNA_BLIT_BACK_KEY ? cell_bits(mask) : 0;
+    ret.back = flags & SODNA_BLIT_BACK_KEY ? cell_bits(key) & ret.back_mask : ~(uint64_t)0;
+    return ret;
+}
+
+/* Branch-free so that the compiler can vectorize the row loops. */
+static uint64_t keyed_cell(uint64_t src, uint64_t dest, const Blit_Key* key) {
+    uint64_t hidden = (uint64_t)0 - ((src & key->symbol_mask) == key->symbol);
+    uint64_t keep_back = ((uint64_t)0 - ((src & key->back_mask) == key->back)) &
+        key->back_mask;
+    uint64_t from_dest = hidden | keep_back;
+    return (src & ~from_dest) | (dest & from_dest);
+}
+
+static void blit_keyed_cell(sodna_Cell* dest, const sodna_Cell* src, const Blit_Key* key) {
+    uint64_t s, d;
+    memcpy(&s, src, sizeof(s));
+    memcpy(&d, dest, sizeof(d));
+    d = keyed_cell(s, d, key);
+    memcpy(dest, &d, sizeof(d));
+}
+
+static void blit_keyed_row(sodna_Cell* dest, const sodna_Cell* src, int count,
+        int backwards, const Blit_Key* key) {
+    int x;
+    if (backwards) {
+        for (x = count - 1; x >= 0; x--)
+            blit_keyed_cell(&dest[x], &src[x], key);
+    } else {
+        for (x = 0; x < count; x++)
+            blit_keyed_cell(&dest[x], &src[x], key);
+    }
+}
+
+void sodna_blit(
+        const sodna_Canvas* src, const sodna_Rect* src_rect,
+        sodna_Canvas* dest, int dest_x, int dest_y,
+        int flags, sodna_Cell key) {
+    sodna_Rect area;
+    Blit_Key blit;
+    int i, backwards;
+    if (!src->cells || !dest->cells)
+        return;
+
+    area.x = 0; area.y = 0; area.w = src->width; area.h = src->height;
+    if (src_rect)
+        area = *src_rect;
+
+    /* Clip to the source canvas, moving the destination along. */
+    if (area.x < 0) { dest_x -= area.x; area.w += area.x; area.x = 0; }
+    if (area.y < 0) { dest_y -= area.y; area.h += area.y; area.y = 0; }
+    if (area.x + area.w > src->width) area.w = src->width - area.x;
+    if (area.y + area.h > src->height) area.h = src->height - area.y;
+
+    /* Clip to the destination canvas. */
+    if (dest_x < 0) { area.x -= dest_x; area.w += dest_x; dest_x = 0; }
+    if (dest_y < 0) { area.y -= dest_y; area.h += dest_y; dest_y = 0; }
+    if (dest_x + area.w > dest->width) area.w = dest->width - dest_x;
+    if (dest_y + area.h > dest->height) area.h = dest->height - dest_y;
+    if (area.w <= 0 || area.h <= 0)
+        return;
+
+    /* Copy from the end when the destination comes after the source, in
+     * case they overlap. */
+    backwards = &dest->cells[dest_y * dest->pitch + dest_x] >
+        &src->cells[area.y * src->pitch + area.x];
+    blit = blit_key(flags, key);
+    for (i = 0; i < area.h; i++) {
+        int y = backwards ? area.h - 1 - i : i;
+        const sodna_Cell* from = &src->cells[(area.y + y) * src->pitch + area.x];
+        sodna_Cell* to = &dest->cells[(dest_y + y) * dest->pitch + dest_x];
+        if (flags)
+            blit_keyed_row(to, from, area.w, backwards, &blit);
+        else
+            memmove(to, from, area.w * sizeof(sodna_Cell));
+    }
+}
+
+void sodna_copy_rect(sodna_Canvas* canvas, const sodna_Rect* rect, int dest_x, int dest_y) {
+    sodna_Cell unused;
+    memset(&unused, 0, sizeof(unused));
+    sodna_blit(canvas, rect, canvas, dest_x, dest_y, 0, unused);
+}
+
+/* Clip a rectangle to the canvas, null for the whole canvas. Return whether
+ * anything is left. */
+static int canvas_area(const sodna_Canvas* canvas, const sodna_Rect* rect, sodna_Rect* out) {
+    out->x = 0; out->y = 0; out->w = canvas->width; out->h = canvas->height;
+    if (rect)
+        *out = *rect;
+    if (out->x < 0) { out->w += out->x; out->x = 0; }
+    if (out->y < 0) { out->h += out->y; out->y = 0; }
+    if (out->x + out->w > canvas->width) out->w = canvas->width - out->x;
+    if (out->y + out->h > canvas->height) out->h = canvas->height - out->y;
+    return canvas->cells && out->w > 0 && out->h > 0;
+}
+
+/* The rectangle primitives work on cells as 64-bit words with masks for
+ * the fields, so that the row loops are plain word loads and stores. */
+static uint64_t color_bits_mask() {
+    sodna_Cell mask;
+    memset(&mask, 0, sizeof(mask));
+    mask.fore.r = mask.fore.g = mask.fore.b = 0xff;
+    mask.back.r = mask.back.g = mask.back.b = 0xff;
+    return cell_bits(mask);
+}
+
+void sodna_fill_rect(sodna_Canvas* canvas, const sodna_Rect* rect, sodna_Cell cell) {
+    sodna_Rect area;
+    int x, y;
+    uint64_t bits = cell_bits(cell);
+    if (!canvas_area(canvas, rect, &area))
+        return;
+    for (y = area.y; y < area.y + area.h; y++) {
+        sodna_Cell* row = &canvas->cells[y * canvas->pitch + area.x];
+        for (x = 0; x < area.w; x++)
+            memcpy(&row[x], &bits, sizeof(bits));
+    }
+}
+
+void sodna_recolor_rect(sodna_Canvas* canvas, const sodna_Rect* rect,
+        sodna_Color fore, sodna_Color back) {
+    sodna_Rect area;
+    sodna_Cell colors;
+    uint64_t mask = color_bits_mask(), color_bits;
+    int x, y;
+    if (!canvas_area(canvas, rect, &area))
+        return;
+    memset(&colors, 0, sizeof(colors));
+    colors.fore = fore;
+    colors.back = back;
+    color_bits = cell_bits(colors) & mask;
+
+    for (y = area.y; y < area.y + area.h; y++) {
+        sodna_Cell* row = &canvas->cells[y * canvas->pitch + area.x];
+        for (x = 0; x < area.w; x++) {
+            uint64_t c;
+            memcpy(&c, &row[x], sizeof(c));
+            c = (c & ~mask) | color_bits;
+            memcpy(&row[x], &c, sizeof(c));
+        }
+    }
+}
+
+void sodna_darken_rect(sodna_Canvas* canvas, const sodna_Rect* rect, uint8_t brightness) {
+    sodna_Rect area;
+    uint64_t mask = color_bits_mask();
+    const uint64_t even_bytes = 0x00ff00ff00ff00ffull;
+    /* Map 255 to 256 so that full brightness is exact. */
+    uint64_t scale = brightness + (brightness >> 7);
+    int x, y;
+    if (!canvas_area(canvas, rect, &area))
+        return;
+
+    for (y = area.y; y < area.y + area.h; y++) {
+        sodna_Cell* row = &canvas->cells[y * canvas->pitch + area.x];
+        for (x = 0; x < area.w; x++) {
+            /* Scale every byte at once in 16-bit lanes, the products can't
+             * carry into the next lane. */
+            uint64_t c, even, odd;
+            memcpy(&c, &row[x], sizeof(c));
+            even = ((c & even_bytes) * scale >> 8) & even_bytes;
+            odd = (((c >> 8) & even_bytes) * scale) & ~even_bytes;
+            c = (c & ~mask) | ((even | odd) & mask);
+            memcpy(&row[x], &c, sizeof(c));
+        }
+    }
+}
+
+/* Map a 0-255 level to a 0-256 scale so that 255 is exact. */
+static int level_scale(uint8_t level) {
+    return level + (level >> 7);
+}
+
+/* Scale the byte channels of a pixel from high to low by factors out of
+ * 256, leaving the alpha byte as it is. */
+static uint32_t scale_8888(uint32_t c, int hi, int mid, int lo) {
+    return (c & 0xff000000) |
+        ((((c >> 16) & 255) * hi >> 8) << 16) |
+        ((((c >> 8) & 255) * mid >> 8) << 8) |
+        ((c & 255) * lo >> 8);
+}
+
+static uint16_t scale_565(uint32_t c, int r, int g, int b) {
+    return (uint16_t)(
+            (((c >> 11) * r >> 8) << 11) |
+            ((((c >> 5) & 63) * g >> 8) << 5) |
+            ((c & 31) * b >> 8));
+}
+
+/* Scale a run of pixels by per-channel factors out of 256. The loops have
+ * no branches or cross-pixel dependencies, so the compiler vectorizes them.
+ */
+static void scale_pixels(uint8_t* pixels, int count, sodna_PixelFormat format,
+        int r, int g, int b) {
+    int i;
+    if (format == SODNA_PIXELS_RGB565) {
+        uint16_t* row = (uint16_t*)pixels;
+        for (i = 0; i < count; i++)
+            row[i] = scale_565(row[i], r, g, b);
+    } else {
+        uint32_t* row = (uint32_t*)pixels;
+        /* Red is the high byte in ARGB and the low byte in ABGR. */
+        int hi = format == SODNA_PIXELS_ARGB8888 ? r : b;
+        int lo = format == SODNA_PIXELS_ARGB8888 ? b : r;
+        for (i = 0; i < count; i++)
+            row[i] = scale_8888(row[i], hi, g, lo);
+    }
+}
+
+static int pixel_size(sodna_PixelFormat format) {
+    return format == SODNA_PIXELS_RGB565 ? 2 : 4;
+}
+
+void sodna_post_scanlines(
+        void* data, uint8_t* pixels, int pitch, sodna_PixelFormat format,
+        const sodna_Rect* rect, int width, int height) {
+    int scale = level_scale(*(const uint8_t*)data);
+    int y;
+    for (y = rect->y | 1; y < rect->y + rect->h; y += 2) {
+        scale_pixels(&pixels[y * pitch + rect->x * pixel_size(format)],
+                rect->w, format, scale, scale, scale);
+    }
+}
+
+/* Vignette scale out of 256 for pixel x of a row. The steps are fixed
+ * point 1/256ths of the distance from the center to the edge, so the
+ * squared distance comes out as 256 at the corners.
+ */
+static int vignette_scale(int x, int width, int step_x, int ny, int strength) {
+    int nx = (2 * x + 1 - width) * step_x >> 16;
+    int dist = (nx * nx + ny * ny) >> 9;
+    return 256 - (strength * dist >> 8);
+}
+
+void sodna_post_vignette(
+        void* data, uint8_t* pixels, int pitch, sodna_PixelFormat format,
+        const sodna_Rect* rect, int width, int height) {
+    int strength = level_scale(*(const uint8_t*)data);
+    int step_x = (256 << 16) / width, step_y = (256 << 16) / height;
+    int x, y;
+    for (y = rect->y; y < rect->y + rect->h; y++) {
+        int ny = (2 * y + 1 - height) * step_y >> 16;
+        if (format == SODNA_PIXELS_RGB565) {
+            uint16_t* row = (uint16_t*)&pixels[y * pitch];
+            for (x = rect->x; x < rect->x + rect->w; x++) {
+                int scale = vignette_scale(x, width, step_x, ny, strength);
+                row[x] = scale_565(row[x], scale, scale, scale);
+            }
+        } else {
+            uint32_t* row = (uint32_t*)&pixels[y * pitch];
+            for (x = rect->x; x < rect->x + rect->w; x++) {
+                int scale = vignette_scale(x, width, step_x, ny, strength);
+                row[x] = scale_8888(row[x], scale, scale, scale);
+            }
+        }
+    }
+}
+
+void sodna_post_grade(
+        void* data, uint8_t* pixels, int pitch, sodna_PixelFormat format,
+        const sodna_Rect* rect, int width, int height) {
+    const sodna_Color* gain = (const sodna_Color*)data;
+    int y;
+    for (y = rect->y; y < rect->y + rect->h; y++) {
+        scale_pixels(&pixels[y * pitch + rect->x * pixel_size(format)],
+                rect->w, format, level_scale(gain->r), level_scale(gain->g),
+                level_scale(gain->b));
+    }
+}
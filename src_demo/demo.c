@@ -4,6 +4,7 @@
 #include <stdio.h>
 
 #include "sodna_util.h"
+#include "sodna_inline.h"
 
 static int g_is_fullscreen = 0;
 
@@ -64,23 +65,24 @@ void update_flame() {
 
 void chaos() {
     int mx = -1, my = -1;
+    const sodna_Terminal* term = sodna_terminal();
     /* Test non-blocking animation. */
     for (;;) {
         int x, y;
         sodna_Event e;
         update_flame();
-        for (y = 0; y < sodna_height(); y++) {
-            for (x = 0; x < sodna_width(); x++) {
+        for (y = 0; y < sodna_term_height(term); y++) {
+            for (x = 0; x < sodna_term_width(term); x++) {
                 int i = flame_buffer[y][x+1] / 8;
                 int r = i > 15 ? 15 : i;
                 int g = i > 15 ? i - 16 : 0;
                 int b = 0;
-                sodna_cells()[x + sodna_width() * y] =
-                    cell(' ', 0x000, (r << 8) + (g << 4) + b);
+                sodna_term_put(term, x, y,
+                    cell(' ', 0x000, (r << 8) + (g << 4) + b));
             }
         }
-        if (mx >= 0 && my >= 0 && mx < sodna_width() && my < sodna_height())
-            sodna_cells()[mx + sodna_width() * my] = cell('X', 0x000, 0x0f0);
+        if (mx >= 0 && my >= 0 && mx < sodna_term_width(term) && my < sodna_term_height(term))
+            sodna_term_put(term, mx, my, cell('X', 0x000, 0x0f0));
         do {
             e = sodna_poll_event();
             switch (e.type) {
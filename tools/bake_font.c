@@ -0,0 +1,39 @@
+/*
+ * Convert a row-major font bitmap 16 characters wide into a baked Sodna
+ * font file that can be mapped into memory with sodna_map_baked_font.
+ */
+
+#include "sodna_util.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+int main(int argc, char* argv[]) {
+    sodna_Font* font = NULL;
+    int num_glyphs = 256;
+    int ret;
+
+    if (argc != 3 && argc != 4) {
+        fprintf(stderr, "Usage: %s infile.png outfile.sdnf [num_glyphs]\n", argv[0]);
+        return 1;
+    }
+    if (argc == 4) {
+        num_glyphs = atoi(argv[3]);
+        if (num_glyphs < 256 || num_glyphs > 0x10000) {
+            fprintf(stderr, "Number of glyphs must be between 256 and 65536\n");
+            return 1;
+        }
+    }
+
+    if (sodna_load_font_sheet(argv[1], num_glyphs, &font) != SODNA_OK) {
+        fprintf(stderr, "Couldn't load font sheet %s\n", argv[1]);
+        return 1;
+    }
+
+    ret = sodna_save_baked_font(font, num_glyphs, argv[2]);
+    free(font);
+    if (ret != SODNA_OK) {
+        fprintf(stderr, "Couldn't write baked font %s\n", argv[2]);
+        return 1;
+    }
+    return 0;
+}